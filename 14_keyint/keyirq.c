@@ -14,19 +14,35 @@
 #include <linux/of_gpio.h>
 #include <linux/of_address.h>
 #include <linux/device.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+
+#include "keyevent.h"
 
 #define KEY_CNT     1
 #define KEY_NAME    "keyirq"
-#define KEY_NUM     1
-#define KEY0_VALUE  0X01
-#define INVAKEY     0XFF
+#define KEY0_VALUE  0X01        /*设备树中没有key-codes时, 第i个按键的键值为KEY0_VALUE+i*/
+#define KEY_FIFO_LEN    64      /*事件队列长度, 必须为2的幂*/
+#define KEY_DEBOUNCE_US     15000       /*默认消抖时间, 可由设备树debounce-us或sysfs的debounce_us修改*/
+#define KEY_DEBOUNCE_MAX_US 1000000
+
+struct key_dev;
 
 struct irq_keydesc{
     int gpio;               /*io编号*/
     int irqnum;              /*中断号*/
-    unsigned char value;    /*键值*/
+    unsigned short value;   /*键值*/
     char name[10];          /*按键名称*/
+    s64 timestamp;          /*一串抖动中第一个边沿的时刻*/
+    bool debouncing;        /*定时器还没有采样, 期间的边沿不更新timestamp*/
+    int pressed;            /*消抖后的状态, 1 按下*/
     irqreturn_t (*irq_handler_t)(int, void *);  /*中断处理函数*/
+    struct key_dev *dev;    /*所属设备*/
+    struct hrtimer timer;    /*消抖定时器, 每个按键一个*/
+    unsigned int debounce_us; /*消抖时间(us)*/
 };
 
 struct key_dev{
@@ -37,126 +53,182 @@ struct key_dev{
     struct class *class;
     struct device *device;
     struct device_node *nd;
-    struct irq_keydesc irqkey[KEY_NUM];
-    struct timer_list timer;
+    struct irq_keydesc *irqkey;             /*按键, 个数由设备树中key-gpios的个数决定*/
+    int keynum;                             /*按键个数*/
 
-    atomic_t keyvalue;       /*按键值*/
-    atomic_t releasekey;     /*按键按下的标志*/
+    DECLARE_KFIFO(events, struct key_event, KEY_FIFO_LEN);  /*按键事件, 定时器写入, read()读出*/
+    spinlock_t event_lock;   /*保护kfifo的写入端, 多个按键的定时器可能同时写入*/
+    struct mutex read_lock;  /*多个读者时保护kfifo的读出端*/
+    unsigned int overflow;   /*队列满时丢弃的事件个数*/
 };
 
 struct key_dev key;
 
-/*中断回调函数*/ 
+/*中断回调函数, 每个按键的dev_id为它自己的irq_keydesc*/ 
 static irqreturn_t keyirq_handler_t(int irq, void *dev_id)
 {
-    struct key_dev *dev = dev_id;
+    struct irq_keydesc *keydesc = dev_id;
 
-    dev->timer.data = (unsigned long)dev_id;
-    mod_timer(&dev->timer, jiffies + msecs_to_jiffies(15));
+    /*消抖期间只记录第一个边沿的时刻*/
+    if(!smp_load_acquire(&keydesc->debouncing)){
+        keydesc->timestamp = ktime_get_ns();
+        keydesc->debouncing = true;
+    }
+
+    /*在消抖时间内再次出现边沿时重新计时*/
+    hrtimer_start(&keydesc->timer, ns_to_ktime((u64)READ_ONCE(keydesc->debounce_us) * NSEC_PER_USEC),
+                  HRTIMER_MODE_REL);
     return IRQ_RETVAL(IRQ_HANDLED);
 }
 
-/*定时器回调函数*/ 
-static void timer_func(unsigned long arg){
+/*定时器回调函数, 消抖后状态变化时产生一个事件*/ 
+static enum hrtimer_restart timer_func(struct hrtimer *timer){
     int value = 0;
-    struct key_dev *dev = (struct key_dev *)arg;
-
-    value = gpio_get_value(dev->irqkey[0].gpio);
-    if(value == 0){     /*按下*/
-        atomic_set(&dev->keyvalue, dev->irqkey[0].value);
-    }else if(value == 1){   /*释放*/
-        if(atomic_read(&dev->keyvalue) == dev->irqkey[0].value){
-            atomic_set(&dev->keyvalue, 0x80 | dev->irqkey[0].value);
-            atomic_set(&dev->releasekey, 1);
-        }
+    s64 timestamp;
+    struct key_event e;
+    struct irq_keydesc *keydesc = container_of(timer, struct irq_keydesc, timer);
+    struct key_dev *dev = keydesc->dev;
+
+    /*采样之前结束消抖, 之后的边沿会记录新的时刻并重新计时*/
+    timestamp = keydesc->timestamp;
+    smp_store_release(&keydesc->debouncing, false);
+
+    value = gpio_get_value(keydesc->gpio) == 0;     /*低电平为按下*/
+    if(value == keydesc->pressed)                   /*抖动后回到原来的状态*/
+        return HRTIMER_NORESTART;
+    keydesc->pressed = value;
+
+    memset(&e, 0, sizeof(e));
+    e.timestamp = timestamp;
+    e.code = keydesc->value;
+    e.value = value;
+    /*队列满时丢弃新事件*/
+    spin_lock(&dev->event_lock);
+    if(!kfifo_put(&dev->events, e))
+        dev->overflow++;
+    spin_unlock(&dev->event_lock);
+    return HRTIMER_NORESTART;
+}
+/*
+* @description : 释放前n个按键的中断、下半部、定时器和GPIO
+*/
+static void keyio_free(struct key_dev *dev, int n)
+{
+    int i = 0;
+
+    for(i = 0; i < n; i++){
+        free_irq(dev->irqkey[i].irqnum, &dev->irqkey[i]);
+        hrtimer_cancel(&dev->irqkey[i].timer);
+        gpio_free(dev->irqkey[i].gpio);
     }
 }
+
 /*
-* @description : keyio初始化
+* @description : keyio初始化, 按键个数和键值来自设备树, 例如:
+*                key {
+*                    key-gpios = <&gpio1 18 GPIO_ACTIVE_LOW>, <&gpio1 19 GPIO_ACTIVE_LOW>;
+*                    key-codes = <0x01 0x02>;    可选
+*                    debounce-us = <5000>;    可选, 单位us
+*                };
 * @return : 0 初始化成功，<0 初始化失败
 */
 static int keyio_init(struct key_dev *dev)
 {
     int ret = 0;
     int i = 0;
+    int num = 0;
+    u32 code = 0;
+    u32 debounce = 0;
+    struct irq_keydesc *keydesc;
+
     /*获取设备节点*/
     dev->nd = of_find_node_by_path("/key");
     if(dev->nd == NULL){
-        ret =  -EINVAL;
-        goto fail_get_nd;
+        return -EINVAL;
     }
 
-    /*获取key的GPIO*/
-    for(i = 0; i< KEY_NUM; i++){
-        dev->irqkey[i].gpio = of_get_named_gpio(dev->nd, "key-gpios", i);
-        if(dev->irqkey[i].gpio < 0){
+    /*按键个数*/
+    num = of_gpio_named_count(dev->nd, "key-gpios");
+    if(num <= 0){
+        printk("No key-gpios!\r\n");
+        return -EINVAL;
+    }
+    dev->irqkey = kcalloc(num, sizeof(*dev->irqkey), GFP_KERNEL);
+    if(!dev->irqkey){
+        return -ENOMEM;
+    }
+
+    for(i = 0; i < num; i++){
+        keydesc = &dev->irqkey[i];
+        keydesc->dev = dev;
+
+        /*键值*/
+        if(of_property_read_u32_index(dev->nd, "key-codes", i, &code))
+            code = KEY0_VALUE + i;
+        keydesc->value = code;
+
+        /*消抖时间, debounce-us可以每个按键一个, 也可以只写一个, 所有按键共用*/
+        if(of_property_read_u32_index(dev->nd, "debounce-us", i, &debounce) &&
+           of_property_read_u32_index(dev->nd, "debounce-us", 0, &debounce))
+            debounce = KEY_DEBOUNCE_US;
+        keydesc->debounce_us = min_t(u32, debounce, KEY_DEBOUNCE_MAX_US);
+
+        /*获取key的GPIO*/
+        keydesc->gpio = of_get_named_gpio(dev->nd, "key-gpios", i);
+        if(keydesc->gpio < 0){
             printk("Get irqkey[%d] failed!\r\n", i);
             ret = -EINVAL;
             goto fail_get_gpio;
         }
-        printk("irqkey[%d] gpio num = %d\r\n", i, dev->irqkey[i].gpio);
-    }
 
-    /*向内核申请io*/
-    for(i = 0; i< KEY_NUM; i++){
-        memset(dev->irqkey[i].name, 0, sizeof(dev->irqkey[i].name));
-        /*格式化name*/ 
-        sprintf(dev->irqkey[i].name, "KEY%d", i); 
-        ret = gpio_request(dev->irqkey[i].gpio, dev->irqkey[i].name);
+        /*向内核申请io*/
+        sprintf(keydesc->name, "KEY%d", i); 
+        ret = gpio_request(keydesc->gpio, keydesc->name);
         if(ret){
             printk("Failed to request the irqkey[%d] gpio\r\n", i);
             ret = -EINVAL;
-            goto fail_reqs_gpio;
+            goto fail_get_gpio;
         }
-    }
 
-    /*设置key的GPIO为输入*/
-    for(i = 0; i< KEY_NUM; i++){
-        ret = gpio_direction_input(dev->irqkey[i].gpio);  /*设置key为输入*/ 
+        /*设置key的GPIO为输入*/
+        ret = gpio_direction_input(keydesc->gpio);
         if(ret){
             ret = -EINVAL;
             goto fail_setup_gpio;
         }
-    }
+        keydesc->pressed = gpio_get_value(keydesc->gpio) == 0;  /*加载时已按下的键不产生按下事件*/
 
-    /*获取key的GPIO的中断号*/
-    for(i = 0; i< KEY_NUM; i++){
-        /*方法一*/ 
-        dev->irqkey[i].irqnum = gpio_to_irq(dev->irqkey[i].gpio);
-        // /*方法二*/ 
-        // dev->irqkey[i].irqnum = irq_of_parse_irq(dev->nd, i);
-        printk("irqkey[%d].irqnum = %d\r\n", i, dev->irqkey[i].irqnum);
-    }
+        /*获取key的GPIO的中断号*/
+        keydesc->irqnum = gpio_to_irq(keydesc->gpio);
+        printk("irqkey[%d] gpio = %d, irqnum = %d, code = %#x\r\n",
+               i, keydesc->gpio, keydesc->irqnum, keydesc->value);
+
+        /*初始化消抖定时器*/
+        hrtimer_init(&keydesc->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+        keydesc->timer.function = timer_func;
 
-    /*初始化中断*/
-    dev->irqkey[0].irq_handler_t = keyirq_handler_t;
-    dev->irqkey[0].value = KEY0_VALUE;
-    for(i = 0; i< KEY_NUM; i++){
-        ret = request_irq(dev->irqkey[i].irqnum,dev->irqkey[i].irq_handler_t, 
+        /*初始化中断*/
+        keydesc->irq_handler_t = keyirq_handler_t;
+        ret = request_irq(keydesc->irqnum, keydesc->irq_handler_t, 
                             IRQF_TRIGGER_RISING|IRQF_TRIGGER_FALLING, 
-                            dev->irqkey[i].name, &key);
+                            keydesc->name, keydesc);
         if(ret){
-            printk("irq %d request failed!\r\n", dev->irqkey[i].irqnum);
+            printk("irq %d request failed!\r\n", keydesc->irqnum);
             ret = -EINVAL;
-            goto fail_requset_irq;
+            goto fail_setup_gpio;
         }
     }
-
-    /* 初始化定时器 */
-    init_timer(&dev->timer); 
-    dev->timer.function = timer_func;
+    /*全部初始化完成后再设置个数, sysfs只会访问到完整的按键*/
+    dev->keynum = num;
 
     return 0;
 
-fail_requset_irq:
 fail_setup_gpio:
-    /*释放key的GPIO*/
-    for(i = 0; i< KEY_NUM; i++){ 
-        gpio_free(key.irqkey[i].gpio);
-    }    
-fail_reqs_gpio:    
-fail_get_gpio:    
-fail_get_nd:
+    gpio_free(dev->irqkey[i].gpio);
+fail_get_gpio:
+    /*释放已经初始化的按键*/
+    keyio_free(dev, i);
+    kfree(dev->irqkey);
     return ret;
 }
 
@@ -175,6 +247,25 @@ static int key_open (struct inode *inode, struct file *filp)
     return ret;
 }
 
+/*
+* @description : 取出一个释放事件, 旧格式只报告按键释放, 之前的按下事件被丢弃
+* @return : true 取到释放事件, false 队列中没有释放事件
+*/
+static bool key_get_release(struct key_dev *dev, struct key_event *e)
+{
+    bool found = false;
+
+    mutex_lock(&dev->read_lock);
+    while(kfifo_get(&dev->events, e)){
+        if(e->value == 0){
+            found = true;
+            break;
+        }
+    }
+    mutex_unlock(&dev->read_lock);
+    return found;
+}
+
 /*
 * @description : 从设备读取数据
 * @param - filp : 设备文件，表示打开的文件描述符
@@ -186,25 +277,27 @@ static int key_open (struct inode *inode, struct file *filp)
 static ssize_t key_read (struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
 { 
     int ret = 0;
+    unsigned int copied = 0;
     unsigned char keyvalue;
-    unsigned char releasekey;
+    struct key_event e;
     struct key_dev *dev = filp->private_data;
 
-    keyvalue = atomic_read(&dev->keyvalue);
-    releasekey = atomic_read(&dev->releasekey);
-
-    if(releasekey){  /*按键有效*/
-        if(keyvalue & 0x80){
-            keyvalue &= ~0x80;
-            ret = copy_to_user(buf, &keyvalue, sizeof(keyvalue));
-        }else{
+    if(cnt < sizeof(struct key_event)){     /*旧格式, 返回1个字节的键值*/
+        if(!key_get_release(dev, &e))
             return -EINVAL;
-        }
-        atomic_set(&dev->releasekey, 0);    /*按下标志清零*/
-    }else{
-        return -EINVAL;
+        keyvalue = e.code;
+        if(copy_to_user(buf, &keyvalue, sizeof(keyvalue)))
+            return -EFAULT;
+        return 0;
     }
-    return ret;
+
+    /*一次读出缓冲区能容纳的所有事件*/
+    mutex_lock(&dev->read_lock);
+    ret = kfifo_to_user(&dev->events, buf, cnt, &copied);
+    mutex_unlock(&dev->read_lock);
+    if(ret)
+        return ret;
+    return copied ? copied : -EAGAIN;
 }
 /*
 * @description : 关闭/释放设备
@@ -216,6 +309,53 @@ static int key_release (struct inode *inode, struct file *filp)
     return 0;
 }
 
+/*
+* @description : 读取每个按键的消抖时间, 每行一个, 单位us
+*/
+static ssize_t debounce_us_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    int i;
+    ssize_t len = 0;
+    struct key_dev *dev = dev_get_drvdata(d);
+
+    for(i = 0; i < dev->keynum; i++)
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%u\n",
+                         READ_ONCE(dev->irqkey[i].debounce_us));
+    return len;
+}
+
+/*
+* @description : 设置消抖时间, "N"设置所有按键, "i N"只设置第i个按键,
+*                下一次按键边沿开始生效
+*/
+static ssize_t debounce_us_store(struct device *d, struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+    int i;
+    unsigned int index, us;
+    struct key_dev *dev = dev_get_drvdata(d);
+
+    if(sscanf(buf, "%u %u", &index, &us) == 2){
+        if(index >= dev->keynum || us > KEY_DEBOUNCE_MAX_US)
+            return -EINVAL;
+        WRITE_ONCE(dev->irqkey[index].debounce_us, us);
+        return count;
+    }
+
+    if(kstrtouint(buf, 0, &us) || us > KEY_DEBOUNCE_MAX_US)
+        return -EINVAL;
+    for(i = 0; i < dev->keynum; i++)
+        WRITE_ONCE(dev->irqkey[i].debounce_us, us);
+    return count;
+}
+static DEVICE_ATTR_RW(debounce_us);
+
+static struct attribute *key_attrs[] = {
+    &dev_attr_debounce_us.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(key);
+
 static struct file_operations key_fops = {
     .owner = THIS_MODULE,
     .open = key_open,
@@ -258,22 +398,24 @@ static int __init mykey_init(void)
         goto fail_class;
     }
 
-    key.device = device_create(key.class, NULL, key.devid, NULL, KEY_NAME);
+    key.device = device_create_with_groups(key.class, NULL, key.devid, &key,
+                                           key_groups, KEY_NAME);
     if(IS_ERR(key.device)){
         ret = PTR_ERR(key.device);
         goto fail_device;
     }
 
+    /*初始化事件队列, 注册中断之前完成*/
+    INIT_KFIFO(key.events);
+    spin_lock_init(&key.event_lock);
+    mutex_init(&key.read_lock);
+
     /*初始化IO*/
     ret =  keyio_init(&key);
     if(ret < 0){
         goto fail_keyio_init;
     }
 
-    /*初始化原子变量*/
-    atomic_set(&key.keyvalue, INVAKEY);
-    atomic_set(&key.releasekey, 0);
-
     printk("key_init()\r\n");
     return 0;
 
@@ -292,19 +434,11 @@ fail_devid:
 
 static void __exit mykey_exit(void)
 {
-    int i = 0;
-    /*删除定时器*/
-    del_timer_sync(&key.timer); 
-    /*释放中断*/
-    for(i = 0; i< KEY_NUM; i++){ 
-        free_irq(key.irqkey[i].irqnum, &key);
-    }
-    /*释放key的GPIO*/
-    for(i = 0; i< KEY_NUM; i++){ 
-        gpio_free(key.irqkey[i].gpio);
-    }
-    /*摧毁设备*/
+    /*摧毁设备, 先删除sysfs再释放按键*/
     device_destroy(key.class, key.devid); 
+    /*释放中断、定时器和GPIO*/
+    keyio_free(&key, key.keynum);
+    kfree(key.irqkey);
     /*摧毁类*/
     class_destroy(key.class); 
     /*删除字符设备*/
@@ -312,6 +446,8 @@ static void __exit mykey_exit(void)
     /*释放设备号*/ 
     unregister_chrdev_region(key.devid, KEY_CNT);
 
+    if(key.overflow)
+        printk("key events dropped = %u\r\n", key.overflow);
     printk("key_exit()\r\n");
 }
 
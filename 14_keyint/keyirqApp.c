@@ -5,15 +5,44 @@
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "time.h"
+#include "keyevent.h"
 
 #define KEY0_VALUE      0XF0
+#define EVENT_BATCH     16
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * 打印一次read()读到的所有按键事件,
+ * delay为按键边沿到应用读到事件的时间, 包含消抖时间, 用来比较各个驱动的延迟。
+ * 这里只打印单次的值, 各驱动的延迟没有在板子上实测过, 需要统计数据时
+ * 用26_keybench的keybenchApp测量
+ */
+static void print_events(const struct key_event *events, int len)
+{
+    int i;
+    long long now = now_ns();
+
+    for(i = 0; i < len / (int)sizeof(events[0]); i++)
+        printf("KEY %#X %s, time = %lld.%06lld s, delay = %lld us\r\n", events[i].code,
+               events[i].value ? "Press" : "Release",
+               events[i].timestamp / 1000000000LL, events[i].timestamp / 1000 % 1000000,
+               (now - events[i].timestamp) / 1000);
+}
 
 int main(int argc, char *argv[])
 {   
     int cnt = 0;
     int fd, retvalue;
     char *filename;
-    unsigned char keyvalue;
+    struct key_event events[EVENT_BATCH];
 
     if(argc != 2)
     {
@@ -31,12 +60,12 @@ int main(int argc, char *argv[])
     }
 
     while(1){
-        retvalue = read(fd, &keyvalue, sizeof(keyvalue));
+        /*一次读出所有未读的事件*/
+        retvalue = read(fd, events, sizeof(events));
         if(retvalue < 0){
 
         }else {
-            if(keyvalue)
-                printf("KEY0 Press, value = %#X\r\n",keyvalue);
+            print_events(events, retvalue);
         }
     }
     
@@ -0,0 +1,487 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/delay.h>
+#include <linux/ide.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/gpio.h>
+#include <asm/mach/map.h>
+#include <asm/uaccess.h>
+#include <asm/io.h>
+#include <linux/cdev.h>
+#include <linux/of.h>
+#include <linux/of_gpio.h>
+#include <linux/of_address.h>
+#include <linux/device.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/interrupt.h>
+#include <linux/sched.h>
+
+#include "keyevent.h"
+
+#define KEY_CNT     1
+#define KEY_NAME    "keyirq"
+#define KEY0_VALUE  0X01        /*设备树中没有key-codes时, 第i个按键的键值为KEY0_VALUE+i*/
+#define KEY_FIFO_LEN    64      /*事件队列长度, 必须为2的幂*/
+#define KEY_DEBOUNCE_US     15000       /*默认消抖时间, 可由设备树debounce-us或sysfs的debounce_us修改*/
+#define KEY_DEBOUNCE_MAX_US 1000000
+
+/*
+ * 中断线程的SCHED_FIFO优先级, 1~99, 默认与内核中断线程相同,
+ * 修改后在线程下一次运行时生效
+ */
+static int thread_prio = MAX_USER_RT_PRIO / 2;
+module_param(thread_prio, int, 0644);
+MODULE_PARM_DESC(thread_prio, "SCHED_FIFO priority of the key irq threads, 1-99");
+
+struct key_dev;
+
+struct irq_keydesc{
+    int gpio;               /*io编号*/
+    int irqnum;              /*中断号*/
+    unsigned short value;   /*键值*/
+    char name[10];          /*按键名称*/
+    s64 timestamp;          /*一串抖动中第一个边沿的时刻*/
+    bool debouncing;        /*中断线程还没有采样, 期间的边沿不更新timestamp*/
+    int pressed;            /*消抖后的状态, 1 按下*/
+    irqreturn_t (*irq_handler_t)(int, void *);  /*中断处理函数*/
+    struct key_dev *dev;    /*所属设备*/
+    unsigned int debounce_us; /*消抖时间(us)*/
+};
+
+struct key_dev{
+    dev_t devid;
+    int major;
+    int minor;
+    struct cdev cdev;
+    struct class *class;
+    struct device *device;
+    struct device_node *nd;
+    struct irq_keydesc *irqkey;             /*按键, 个数由设备树中key-gpios的个数决定*/
+    int keynum;                             /*按键个数*/
+
+    DECLARE_KFIFO(events, struct key_event, KEY_FIFO_LEN);  /*按键事件, 中断线程写入, read()读出*/
+    spinlock_t event_lock;   /*保护kfifo的写入端, 多个按键的中断线程可能同时写入*/
+    struct mutex read_lock;  /*多个读者时保护kfifo的读出端*/
+    unsigned int overflow;   /*队列满时丢弃的事件个数*/
+};
+
+struct key_dev key;
+
+/*
+ * 中断上半部, 只记录边沿时刻并唤醒中断线程。
+ * 边沿中断在中断线程运行期间不一定被IRQF_ONESHOT屏蔽, 屏蔽期间到来的边沿
+ * 也会在解除屏蔽时再进入这里, 所以消抖期间只记录第一个边沿的时刻,
+ * 事件时间是一串抖动的第一个边沿
+ */
+static irqreturn_t keyirq_handler_t(int irq, void *dev_id)
+{
+    struct irq_keydesc *keydesc = dev_id;
+
+    if(!smp_load_acquire(&keydesc->debouncing)){
+        keydesc->timestamp = ktime_get_ns();
+        keydesc->debouncing = true;
+    }
+    return IRQ_WAKE_THREAD;
+}
+
+/*
+* @description : 按thread_prio设置当前中断线程的优先级
+*/
+static void keythread_set_prio(void)
+{
+    int prio = READ_ONCE(thread_prio);
+    struct sched_param param = { .sched_priority = prio };
+
+    if(prio < 1 || prio >= MAX_USER_RT_PRIO || current->rt_priority == prio)
+        return;
+    if(sched_setscheduler(current, SCHED_FIFO, &param))
+        printk("set irq thread priority %d failed!\r\n", prio);
+}
+
+/*
+ * 中断线程, 等待消抖时间后采样, 状态变化时直接产生事件,
+ * 不再经过tasklet/work和定时器
+ */
+static irqreturn_t keyirq_thread_fn(int irq, void *dev_id)
+{
+    int value = 0;
+    unsigned int us;
+    s64 timestamp;
+    struct key_event e;
+    struct irq_keydesc *keydesc = dev_id;
+    struct key_dev *dev = keydesc->dev;
+
+    keythread_set_prio();
+
+    /*线程可以睡眠, 直接等待消抖时间*/
+    us = READ_ONCE(keydesc->debounce_us);
+    if(us)
+        usleep_range(us, us + 100);
+
+    /*采样之前结束消抖, 之后的边沿会记录新的时刻并让线程再运行一次*/
+    timestamp = keydesc->timestamp;
+    smp_store_release(&keydesc->debouncing, false);
+
+    value = gpio_get_value(keydesc->gpio) == 0;     /*低电平为按下*/
+    if(value == keydesc->pressed)                   /*抖动后回到原来的状态*/
+        return IRQ_HANDLED;
+    keydesc->pressed = value;
+
+    memset(&e, 0, sizeof(e));
+    e.timestamp = timestamp;
+    e.code = keydesc->value;
+    e.value = value;
+    /*队列满时丢弃新事件*/
+    spin_lock(&dev->event_lock);
+    if(!kfifo_put(&dev->events, e))
+        dev->overflow++;
+    spin_unlock(&dev->event_lock);
+    return IRQ_HANDLED;
+}
+/*
+* @description : 释放前n个按键的中断和GPIO, free_irq会等待中断线程结束
+*/
+static void keyio_free(struct key_dev *dev, int n)
+{
+    int i = 0;
+
+    for(i = 0; i < n; i++){
+        free_irq(dev->irqkey[i].irqnum, &dev->irqkey[i]);
+        gpio_free(dev->irqkey[i].gpio);
+    }
+}
+
+/*
+* @description : keyio初始化, 按键个数和键值来自设备树, 例如:
+*                key {
+*                    key-gpios = <&gpio1 18 GPIO_ACTIVE_LOW>, <&gpio1 19 GPIO_ACTIVE_LOW>;
+*                    key-codes = <0x01 0x02>;    可选
+*                    debounce-us = <5000>;    可选, 单位us
+*                };
+* @return : 0 初始化成功，<0 初始化失败
+*/
+static int keyio_init(struct key_dev *dev)
+{
+    int ret = 0;
+    int i = 0;
+    int num = 0;
+    u32 code = 0;
+    u32 debounce = 0;
+    struct irq_keydesc *keydesc;
+
+    /*获取设备节点*/
+    dev->nd = of_find_node_by_path("/key");
+    if(dev->nd == NULL){
+        return -EINVAL;
+    }
+
+    /*按键个数*/
+    num = of_gpio_named_count(dev->nd, "key-gpios");
+    if(num <= 0){
+        printk("No key-gpios!\r\n");
+        return -EINVAL;
+    }
+    dev->irqkey = kcalloc(num, sizeof(*dev->irqkey), GFP_KERNEL);
+    if(!dev->irqkey){
+        return -ENOMEM;
+    }
+
+    for(i = 0; i < num; i++){
+        keydesc = &dev->irqkey[i];
+        keydesc->dev = dev;
+
+        /*键值*/
+        if(of_property_read_u32_index(dev->nd, "key-codes", i, &code))
+            code = KEY0_VALUE + i;
+        keydesc->value = code;
+
+        /*消抖时间, debounce-us可以每个按键一个, 也可以只写一个, 所有按键共用*/
+        if(of_property_read_u32_index(dev->nd, "debounce-us", i, &debounce) &&
+           of_property_read_u32_index(dev->nd, "debounce-us", 0, &debounce))
+            debounce = KEY_DEBOUNCE_US;
+        keydesc->debounce_us = min_t(u32, debounce, KEY_DEBOUNCE_MAX_US);
+
+        /*获取key的GPIO*/
+        keydesc->gpio = of_get_named_gpio(dev->nd, "key-gpios", i);
+        if(keydesc->gpio < 0){
+            printk("Get irqkey[%d] failed!\r\n", i);
+            ret = -EINVAL;
+            goto fail_get_gpio;
+        }
+
+        /*向内核申请io*/
+        sprintf(keydesc->name, "KEY%d", i); 
+        ret = gpio_request(keydesc->gpio, keydesc->name);
+        if(ret){
+            printk("Failed to request the irqkey[%d] gpio\r\n", i);
+            ret = -EINVAL;
+            goto fail_get_gpio;
+        }
+
+        /*设置key的GPIO为输入*/
+        ret = gpio_direction_input(keydesc->gpio);
+        if(ret){
+            ret = -EINVAL;
+            goto fail_setup_gpio;
+        }
+        keydesc->pressed = gpio_get_value(keydesc->gpio) == 0;  /*加载时已按下的键不产生按下事件*/
+
+        /*获取key的GPIO的中断号*/
+        keydesc->irqnum = gpio_to_irq(keydesc->gpio);
+        printk("irqkey[%d] gpio = %d, irqnum = %d, code = %#x\r\n",
+               i, keydesc->gpio, keydesc->irqnum, keydesc->value);
+
+        /*初始化中断, 消抖和产生事件都在中断线程中完成*/
+        keydesc->irq_handler_t = keyirq_handler_t;
+        ret = request_threaded_irq(keydesc->irqnum, keydesc->irq_handler_t, keyirq_thread_fn,
+                            IRQF_TRIGGER_RISING|IRQF_TRIGGER_FALLING|IRQF_ONESHOT, 
+                            keydesc->name, keydesc);
+        if(ret){
+            printk("irq %d request failed!\r\n", keydesc->irqnum);
+            ret = -EINVAL;
+            goto fail_setup_gpio;
+        }
+    }
+    /*全部初始化完成后再设置个数, sysfs只会访问到完整的按键*/
+    dev->keynum = num;
+
+    return 0;
+
+fail_setup_gpio:
+    gpio_free(dev->irqkey[i].gpio);
+fail_get_gpio:
+    /*释放已经初始化的按键*/
+    keyio_free(dev, i);
+    kfree(dev->irqkey);
+    return ret;
+}
+
+/*
+* @description     :打开设备
+* @param - inode   :传递给驱动的inode
+* @param - filp    :设备文件，file结构体有个叫做private_data的成员变量
+*                   一般在open的时候将private_data指向设备结构体。
+* @return          : 0 成功；
+*/
+static int key_open (struct inode *inode, struct file *filp)
+{   
+    int ret = 0;
+    filp->private_data = &key;
+
+    return ret;
+}
+
+/*
+* @description : 取出一个释放事件, 旧格式只报告按键释放, 之前的按下事件被丢弃
+* @return : true 取到释放事件, false 队列中没有释放事件
+*/
+static bool key_get_release(struct key_dev *dev, struct key_event *e)
+{
+    bool found = false;
+
+    mutex_lock(&dev->read_lock);
+    while(kfifo_get(&dev->events, e)){
+        if(e->value == 0){
+            found = true;
+            break;
+        }
+    }
+    mutex_unlock(&dev->read_lock);
+    return found;
+}
+
+/*
+* @description : 从设备读取数据
+* @param - filp : 设备文件，表示打开的文件描述符
+* @param - buf : 要给设备获取的数据
+* @param - cnt : 要读取的数据长度
+* @param - offt : 相对于文件首地址的偏移
+* @return : 读入的字节数，如果为负值，表示读取失败
+*/
+static ssize_t key_read (struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
+{ 
+    int ret = 0;
+    unsigned int copied = 0;
+    unsigned char keyvalue;
+    struct key_event e;
+    struct key_dev *dev = filp->private_data;
+
+    if(cnt < sizeof(struct key_event)){     /*旧格式, 返回1个字节的键值*/
+        if(!key_get_release(dev, &e))
+            return -EINVAL;
+        keyvalue = e.code;
+        if(copy_to_user(buf, &keyvalue, sizeof(keyvalue)))
+            return -EFAULT;
+        return 0;
+    }
+
+    /*一次读出缓冲区能容纳的所有事件*/
+    mutex_lock(&dev->read_lock);
+    ret = kfifo_to_user(&dev->events, buf, cnt, &copied);
+    mutex_unlock(&dev->read_lock);
+    if(ret)
+        return ret;
+    return copied ? copied : -EAGAIN;
+}
+/*
+* @description : 关闭/释放设备
+* @param - filp : 要关闭的设备文件(文件描述符)
+* @return : 0 成功;其他 失败
+*/
+static int key_release (struct inode *inode, struct file *filp)
+{
+    return 0;
+}
+
+/*
+* @description : 读取每个按键的消抖时间, 每行一个, 单位us
+*/
+static ssize_t debounce_us_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    int i;
+    ssize_t len = 0;
+    struct key_dev *dev = dev_get_drvdata(d);
+
+    for(i = 0; i < dev->keynum; i++)
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%u\n",
+                         READ_ONCE(dev->irqkey[i].debounce_us));
+    return len;
+}
+
+/*
+* @description : 设置消抖时间, "N"设置所有按键, "i N"只设置第i个按键,
+*                下一次按键边沿开始生效
+*/
+static ssize_t debounce_us_store(struct device *d, struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+    int i;
+    unsigned int index, us;
+    struct key_dev *dev = dev_get_drvdata(d);
+
+    if(sscanf(buf, "%u %u", &index, &us) == 2){
+        if(index >= dev->keynum || us > KEY_DEBOUNCE_MAX_US)
+            return -EINVAL;
+        WRITE_ONCE(dev->irqkey[index].debounce_us, us);
+        return count;
+    }
+
+    if(kstrtouint(buf, 0, &us) || us > KEY_DEBOUNCE_MAX_US)
+        return -EINVAL;
+    for(i = 0; i < dev->keynum; i++)
+        WRITE_ONCE(dev->irqkey[i].debounce_us, us);
+    return count;
+}
+static DEVICE_ATTR_RW(debounce_us);
+
+static struct attribute *key_attrs[] = {
+    &dev_attr_debounce_us.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(key);
+
+static struct file_operations key_fops = {
+    .owner = THIS_MODULE,
+    .open = key_open,
+    .read = key_read,
+    .release = key_release,
+};
+
+
+static int __init mykey_init(void)
+{
+    int ret = 0;
+
+    /*申请设备号*/ 
+    key.major = 0;
+    if(key.major){
+        key.devid = MKDEV(key.major, 0);
+        ret = register_chrdev_region(key.devid, KEY_CNT, KEY_NAME);
+    }else{
+        ret = alloc_chrdev_region(&key.devid, 0, KEY_CNT, KEY_NAME);
+        key.major = MAJOR(key.devid);
+        key.minor = MINOR(key.devid);
+    }
+    if(ret < 0){
+        goto fail_devid;
+    }
+    printk("key major = %d, minor = %d\r\n", key.major, key.minor);
+
+    /*注册字符设备*/ 
+    key.cdev.owner = THIS_MODULE;
+    cdev_init(&key.cdev, &key_fops);
+    ret = cdev_add(&key.cdev, key.devid, KEY_CNT);
+    if(ret < 0){
+        goto fail_cdev;
+    }
+
+    /*自动创建设备节点*/ 
+    key.class = class_create(THIS_MODULE, KEY_NAME);
+    if(IS_ERR(key.class)){
+        ret = PTR_ERR(key.class);
+        goto fail_class;
+    }
+
+    key.device = device_create_with_groups(key.class, NULL, key.devid, &key,
+                                           key_groups, KEY_NAME);
+    if(IS_ERR(key.device)){
+        ret = PTR_ERR(key.device);
+        goto fail_device;
+    }
+
+    /*初始化事件队列, 注册中断之前完成*/
+    INIT_KFIFO(key.events);
+    spin_lock_init(&key.event_lock);
+    mutex_init(&key.read_lock);
+
+    /*初始化IO*/
+    ret =  keyio_init(&key);
+    if(ret < 0){
+        goto fail_keyio_init;
+    }
+
+    printk("key_init()\r\n");
+    return 0;
+
+fail_keyio_init:
+    device_destroy(key.class, key.devid); 
+fail_device:
+    class_destroy(key.class); 
+fail_class:
+    cdev_del(&key.cdev); 
+fail_cdev:
+    unregister_chrdev_region(key.devid, KEY_CNT);
+fail_devid:
+    return ret;
+
+}
+
+static void __exit mykey_exit(void)
+{
+    /*摧毁设备, 先删除sysfs再释放按键*/
+    device_destroy(key.class, key.devid); 
+    /*释放中断和GPIO*/
+    keyio_free(&key, key.keynum);
+    kfree(key.irqkey);
+    /*摧毁类*/
+    class_destroy(key.class); 
+    /*删除字符设备*/
+    cdev_del(&key.cdev); 
+    /*释放设备号*/ 
+    unregister_chrdev_region(key.devid, KEY_CNT);
+
+    if(key.overflow)
+        printk("key events dropped = %u\r\n", key.overflow);
+    printk("key_exit()\r\n");
+}
+
+
+module_init(mykey_init);
+module_exit(mykey_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("mankc");
\ No newline at end of file
@@ -5,15 +5,28 @@
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "keyevent.h"
 
 #define KEY0_VALUE      0XF0
+#define EVENT_BATCH     16
+
+/*打印一次read()读到的所有按键事件*/
+static void print_events(const struct key_event *events, int len)
+{
+    int i;
+
+    for(i = 0; i < len / (int)sizeof(events[0]); i++)
+        printf("KEY %#X %s, time = %lld.%06lld s\r\n", events[i].code,
+               events[i].value ? "Press" : "Release",
+               events[i].timestamp / 1000000000LL, events[i].timestamp / 1000 % 1000000);
+}
 
 int main(int argc, char *argv[])
 {   
     int cnt = 0;
     int fd, retvalue;
     char *filename;
-    unsigned char keyvalue;
+    struct key_event events[EVENT_BATCH];
 
     if(argc != 2)
     {
@@ -31,12 +44,12 @@ int main(int argc, char *argv[])
     }
 
     while(1){
-        retvalue = read(fd, &keyvalue, sizeof(keyvalue));
+        /*一次读出所有未读的事件*/
+        retvalue = read(fd, events, sizeof(events));
         if(retvalue < 0){
 
         }else {
-            if(keyvalue)
-                printf("KEY0 Press, value = %#X\r\n",keyvalue);
+            print_events(events, retvalue);
         }
     }
     
@@ -8,17 +8,33 @@
 #include <sys/select.h>
 #include <sys/time.h>
 #include <poll.h>
+#include "keyevent.h"
 
 
 
 #define KEY0_VALUE      0XF0
+#define EVENT_BATCH     16
+
+/*打印一次read()读到的所有按键事件*/
+static void print_events(const struct key_event *events, int len)
+{
+    int i;
+
+    for(i = 0; i < len / (int)sizeof(events[0]); i++)
+        printf("KEY %#X %s, time = %lld.%06lld s\r\n", events[i].code,
+               events[i].value ? "Press" : "Release",
+               events[i].timestamp / 1000000000LL, events[i].timestamp / 1000 % 1000000);
+}
 
 int main(int argc, char *argv[])
 {   
     int cnt = 0;
     int fd, retvalue;
     char *filename;
-    unsigned char keyvalue;
+#if 0
+    unsigned char keyvalue;     /*只有下面关闭的select示例使用*/
+#endif
+    struct key_event events[EVENT_BATCH];
     struct pollfd fds;
     fd_set readfds;
     struct timeval timeout;
@@ -76,13 +92,12 @@ int main(int argc, char *argv[])
     while(1){
         retvalue = poll(&fds, 1, 500);
 
-        if(retvalue) {      /*数据有效*/
-            retvalue = read(fd, &keyvalue, sizeof(keyvalue));
+        if(retvalue > 0) {  /*数据有效, 一次读出所有未读的事件*/
+            retvalue = read(fd, events, sizeof(events));
             if(retvalue < 0){
                 printf("read data failed!\r\n");
             }else {
-                if(keyvalue)
-                    printf("KEY0 Press, value = %#X\r\n",keyvalue);
+                print_events(events, retvalue);
             }
         }else if(retvalue == 0) {       /*超时*/
             printf("poll timeout!\r\n");
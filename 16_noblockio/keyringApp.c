@@ -0,0 +1,90 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "sys/mman.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include <poll.h>
+#include "keyevent.h"
+
+/*
+ * 通过mmap的环形缓冲区读取按键事件:
+ *     ./keyringApp /dev/noblockio
+ * 缓冲区中有事件时直接读取, 不进入内核, 只有缓冲区为空时才调用poll()等待
+ */
+
+/*打印缓冲区中所有未读的事件, 返回读到的事件个数*/
+static int consume(struct key_ring *ring)
+{
+    int n = 0;
+    unsigned int tail = ring->tail;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    struct key_event *e;
+
+    while(tail != head){
+        e = &ring->events[tail & (ring->size - 1)];
+        printf("KEY %#X %s, time = %lld.%06lld s\r\n", e->code,
+               e->value ? "Press" : "Release",
+               e->timestamp / 1000000000LL, e->timestamp / 1000 % 1000000);
+        tail++;
+        n++;
+    }
+    /*事件读完以后再交还这些位置*/
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd, ret;
+    unsigned int dropped = 0;
+    struct key_ring *ring;
+    struct pollfd fds;
+
+    if(argc != 2)
+    {
+        printf("Error param!\r\n");
+        return -1;
+    }
+
+    fd = open(argv[1], O_RDWR);
+    if(fd < 0)
+    {
+        printf("file %s open failed!\r\n", argv[1]);
+        return -1;
+    }
+
+    ring = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ring == MAP_FAILED)
+    {
+        printf("mmap failed!\r\n");
+        close(fd);
+        return -1;
+    }
+    printf("ring size = %u events\r\n", ring->size);
+
+    fds.fd = fd;
+    fds.events = POLLIN;
+    while(1){
+        if(consume(ring))
+            continue;
+
+        if(ring->dropped != dropped){
+            printf("%u events dropped\r\n", ring->dropped - dropped);
+            dropped = ring->dropped;
+        }
+
+        /*缓冲区为空, 等待新事件*/
+        ret = poll(&fds, 1, -1);
+        if(ret < 0){
+            printf("poll error!\r\n");
+            break;
+        }
+    }
+
+    munmap(ring, getpagesize());
+    close(fd);
+    return 0;
+}
@@ -8,22 +8,27 @@
 #include "signal.h"
 #include "fcntl.h"
 #include "poll.h"
+#include "keyevent.h"
 
 #define KEY0_VALUE      0XF0
+#define EVENT_BATCH     16
 
 static int fd = 0;      /*全局变量文件描述符*/
 
 static void sigio_signal_func(int signum)
 {
+    int i = 0;
     int err = 0;
-    unsigned char keyvalue = 0;
+    struct key_event events[EVENT_BATCH];
 
-    err = read(fd, &keyvalue, sizeof(keyvalue));
+    /*一个SIGIO可能对应多个事件, 一次全部读出*/
+    err = read(fd, events, sizeof(events));
     if(err < 0){
         /*读取错误*/
     }else {
-        if(keyvalue)
-            printf("sigio signal! KEY0 Press, value = %#X\r\n",keyvalue);
+        for(i = 0; i < err / (int)sizeof(events[0]); i++)
+            printf("sigio signal! KEY %#X %s\r\n", events[i].code,
+                   events[i].value ? "Press" : "Release");
         }    
 }
 
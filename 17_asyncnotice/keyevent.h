@@ -0,0 +1,18 @@
+#ifndef _KEYEVENT_H
+#define _KEYEVENT_H
+
+/*
+ * 按键驱动与应用程序共用的事件格式
+ * read()的缓冲区不小于struct key_event时, 一次返回缓冲区能容纳的所有事件和它们的长度,
+ * 否则按旧格式返回1个字节的键值, 只报告按键释放, read返回0
+ */
+#include <linux/types.h>
+
+struct key_event {
+    __s64 timestamp;    /* 按键开始抖动(第一个边沿)的ktime(CLOCK_MONOTONIC, 单位ns) */
+    __u16 code;         /* 键值 */
+    __u16 value;        /* 1 按下, 0 释放 */
+    __u32 reserved;
+};
+
+#endif // !_KEYEVENT_H
@@ -15,169 +15,256 @@
 #include <linux/of_address.h>
 #include <linux/device.h>
 #include <linux/input.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
 
 #define KEYINPUT_NAME       "keyinput"
-#define KEY_NUM             1
+#define KEY_DEBOUNCE_US     20000       /*默认消抖时间, 可由设备树debounce-us或sysfs的debounce_us修改*/
+#define KEY_DEBOUNCE_MAX_US 1000000
+
+struct keyinput_dev;
 
 struct irq_keydesc{
     int gpio;               /*io编号*/
     int irqnum;              /*中断号*/
-    unsigned char value;    /*键值*/
+    unsigned short value;   /*键值, input子系统的按键码*/
     char name[10];          /*按键名称*/
     irqreturn_t (*irq_handler_t)(int, void *);  /*中断处理函数*/
+    struct keyinput_dev *dev;   /*所属设备*/
+    struct hrtimer timer;       /*消抖定时器, 每个按键一个*/
+    unsigned int debounce_us;   /*消抖时间(us)*/
 };
 
 struct keyinput_dev{
     struct device_node *nd;
-    struct irq_keydesc irqkey[KEY_NUM];
-    struct timer_list timer;
+    struct irq_keydesc *irqkey;     /*按键, 个数由设备树中key-gpios的个数决定*/
+    int keynum;                     /*按键个数*/
 
     struct input_dev *inputdev;
 };
 
 struct keyinput_dev keyinputdev;
 
-/*中断回调函数*/ 
+/*中断回调函数, 每个按键的dev_id为它自己的irq_keydesc*/ 
 static irqreturn_t keyinput_handler_t(int irq, void *dev_id)
 {
-    struct keyinput_dev *dev = dev_id;
+    struct irq_keydesc *keydesc = dev_id;
 
-    dev->timer.data = (unsigned long)dev_id;
-    mod_timer(&dev->timer, jiffies + msecs_to_jiffies(20));
+    /*在消抖时间内再次出现边沿时重新计时*/
+    hrtimer_start(&keydesc->timer, ns_to_ktime((u64)READ_ONCE(keydesc->debounce_us) * NSEC_PER_USEC),
+                  HRTIMER_MODE_REL);
     return IRQ_RETVAL(IRQ_HANDLED);
 }
 
 /*定时器回调函数*/ 
-static void timer_func(unsigned long arg){
+static enum hrtimer_restart timer_func(struct hrtimer *timer){
     int value = 0;
-    struct keyinput_dev *dev = (struct keyinput_dev *)arg;
+    struct irq_keydesc *keydesc = container_of(timer, struct irq_keydesc, timer);
+    struct keyinput_dev *dev = keydesc->dev;
 
-    value = gpio_get_value(dev->irqkey[0].gpio);
+    value = gpio_get_value(keydesc->gpio);
     if(value == 0){     /*按下*/
         /*上报数据*/
-        input_event(dev->inputdev,EV_KEY, KEY_0, 1);
+        input_event(dev->inputdev,EV_KEY, keydesc->value, 1);
         input_sync(dev->inputdev);
     }else if(value == 1){   /*释放*/
         /*上报数据*/
-        input_event(dev->inputdev,EV_KEY, KEY_0, 0);
+        input_event(dev->inputdev,EV_KEY, keydesc->value, 0);
         input_sync(dev->inputdev);
     }
+    return HRTIMER_NORESTART;
+}
+/*
+* @description : 释放前n个按键的中断、定时器和GPIO
+*/
+static void keyio_free(struct keyinput_dev *dev, int n)
+{
+    int i = 0;
+
+    for(i = 0; i < n; i++){
+        free_irq(dev->irqkey[i].irqnum, &dev->irqkey[i]);
+        hrtimer_cancel(&dev->irqkey[i].timer);
+        gpio_free(dev->irqkey[i].gpio);
+    }
 }
+
 /*
-* @description : keyio初始化
+* @description : 读取每个按键的消抖时间, 每行一个, 单位us
+*/
+static ssize_t debounce_us_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    int i;
+    ssize_t len = 0;
+    struct keyinput_dev *dev = &keyinputdev;
+
+    for(i = 0; i < dev->keynum; i++)
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%u\n",
+                         READ_ONCE(dev->irqkey[i].debounce_us));
+    return len;
+}
+
+/*
+* @description : 设置消抖时间, "N"设置所有按键, "i N"只设置第i个按键,
+*                下一次按键边沿开始生效
+*/
+static ssize_t debounce_us_store(struct device *d, struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+    int i;
+    unsigned int index, us;
+    struct keyinput_dev *dev = &keyinputdev;
+
+    if(sscanf(buf, "%u %u", &index, &us) == 2){
+        if(index >= dev->keynum || us > KEY_DEBOUNCE_MAX_US)
+            return -EINVAL;
+        WRITE_ONCE(dev->irqkey[index].debounce_us, us);
+        return count;
+    }
+
+    if(kstrtouint(buf, 0, &us) || us > KEY_DEBOUNCE_MAX_US)
+        return -EINVAL;
+    for(i = 0; i < dev->keynum; i++)
+        WRITE_ONCE(dev->irqkey[i].debounce_us, us);
+    return count;
+}
+static DEVICE_ATTR_RW(debounce_us);
+
+static struct attribute *keyinput_attrs[] = {
+    &dev_attr_debounce_us.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(keyinput);
+
+/*
+* @description : keyio初始化, 按键个数和键值来自设备树, 例如:
+*                key {
+*                    key-gpios = <&gpio1 18 GPIO_ACTIVE_LOW>, <&gpio1 19 GPIO_ACTIVE_LOW>;
+*                    key-codes = <KEY_0 KEY_1>;    可选, 没有时为KEY_0, BTN_TRIGGER_HAPPY1, ...
+*                    debounce-us = <5000>;    可选, 单位us
+*                };
 * @return : 0 初始化成功，<0 初始化失败
 */
 static int keyio_init(struct keyinput_dev *dev)
 {
     int ret = 0;
     int i = 0;
+    u32 code = 0;
+    u32 debounce = 0;
+    struct irq_keydesc *keydesc;
+
     /*获取设备节点*/
     dev->nd = of_find_node_by_path("/key");
     if(dev->nd == NULL){
-        ret =  -EINVAL;
-        goto fail_get_nd;
+        return -EINVAL;
+    }
+
+    /*按键个数*/
+    dev->keynum = of_gpio_named_count(dev->nd, "key-gpios");
+    if(dev->keynum <= 0){
+        printk("No key-gpios!\r\n");
+        return -EINVAL;
+    }
+    dev->irqkey = kcalloc(dev->keynum, sizeof(*dev->irqkey), GFP_KERNEL);
+    if(!dev->irqkey){
+        return -ENOMEM;
     }
 
-    /*获取key的GPIO*/
-    for(i = 0; i< KEY_NUM; i++){
-        dev->irqkey[i].gpio = of_get_named_gpio(dev->nd, "key-gpios", i);
-        if(dev->irqkey[i].gpio < 0){
+    /*申请input_dev, 中断中会用到, 在注册中断之前申请*/
+    dev->inputdev = input_allocate_device();
+    if(dev->inputdev == NULL){
+        ret = -ENOMEM;
+        goto fail_alloc_input;
+    }
+
+    /*初始化inputdev*/
+    dev->inputdev->name = KEYINPUT_NAME;
+    dev->inputdev->dev.groups = keyinput_groups;    /*sysfs: debounce_us*/
+    __set_bit(EV_KEY, dev->inputdev->evbit);        /*按键事件*/
+    __set_bit(EV_REP, dev->inputdev->evbit);        /*重复事件*/
+
+    for(i = 0; i < dev->keynum; i++){
+        keydesc = &dev->irqkey[i];
+        keydesc->dev = dev;
+
+        /*键值*/
+        if(of_property_read_u32_index(dev->nd, "key-codes", i, &code))
+            code = i == 0 ? KEY_0 : BTN_TRIGGER_HAPPY1 + i - 1;
+        if(code > KEY_MAX){
+            printk("irqkey[%d] code %#x invalid!\r\n", i, code);
+            ret = -EINVAL;
+            goto fail_get_gpio;
+        }
+        keydesc->value = code;
+
+        /*消抖时间, debounce-us可以每个按键一个, 也可以只写一个, 所有按键共用*/
+        if(of_property_read_u32_index(dev->nd, "debounce-us", i, &debounce) &&
+           of_property_read_u32_index(dev->nd, "debounce-us", 0, &debounce))
+            debounce = KEY_DEBOUNCE_US;
+        keydesc->debounce_us = min_t(u32, debounce, KEY_DEBOUNCE_MAX_US);
+
+        __set_bit(code, dev->inputdev->keybit);     /*按键值*/
+
+        /*获取key的GPIO*/
+        keydesc->gpio = of_get_named_gpio(dev->nd, "key-gpios", i);
+        if(keydesc->gpio < 0){
             printk("Get irqkey[%d] failed!\r\n", i);
             ret = -EINVAL;
             goto fail_get_gpio;
         }
-        printk("irqkey[%d] gpio num = %d\r\n", i, dev->irqkey[i].gpio);
-    }
 
-    /*向内核申请io*/
-    for(i = 0; i< KEY_NUM; i++){
-        memset(dev->irqkey[i].name, 0, sizeof(dev->irqkey[i].name));
-        /*格式化name*/ 
-        sprintf(dev->irqkey[i].name, "KEY%d", i); 
-        ret = gpio_request(dev->irqkey[i].gpio, dev->irqkey[i].name);
+        /*向内核申请io*/
+        sprintf(keydesc->name, "KEY%d", i); 
+        ret = gpio_request(keydesc->gpio, keydesc->name);
         if(ret){
             printk("Failed to request the irqkey[%d] gpio\r\n", i);
             ret = -EINVAL;
-            goto fail_reqs_gpio;
+            goto fail_get_gpio;
         }
-    }
 
-    /*设置key的GPIO为输入*/
-    for(i = 0; i< KEY_NUM; i++){
-        ret = gpio_direction_input(dev->irqkey[i].gpio);  /*设置key为输入*/ 
+        /*设置key的GPIO为输入*/
+        ret = gpio_direction_input(keydesc->gpio);
         if(ret){
             ret = -EINVAL;
             goto fail_setup_gpio;
         }
-    }
 
-    /*获取key的GPIO的中断号*/
-    for(i = 0; i< KEY_NUM; i++){
-        /*方法一*/ 
-        dev->irqkey[i].irqnum = gpio_to_irq(dev->irqkey[i].gpio);
-        // /*方法二*/ 
-        // dev->irqkey[i].irqnum = irq_of_parse_irq(dev->nd, i);
-        printk("irqkey[%d].irqnum = %d\r\n", i, dev->irqkey[i].irqnum);
-    }
+        /*获取key的GPIO的中断号*/
+        keydesc->irqnum = gpio_to_irq(keydesc->gpio);
+        printk("irqkey[%d] gpio = %d, irqnum = %d, code = %d\r\n",
+               i, keydesc->gpio, keydesc->irqnum, keydesc->value);
+
+        /* 初始化定时器 */
+        hrtimer_init(&keydesc->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+        keydesc->timer.function = timer_func;
 
-    /*初始化中断*/
-    dev->irqkey[0].irq_handler_t = keyinput_handler_t;
-    dev->irqkey[0].value = KEY_0;
-    for(i = 0; i< KEY_NUM; i++){
-        ret = request_irq(dev->irqkey[i].irqnum,dev->irqkey[i].irq_handler_t, 
+        /*初始化中断*/
+        keydesc->irq_handler_t = keyinput_handler_t;
+        ret = request_irq(keydesc->irqnum, keydesc->irq_handler_t, 
                             IRQF_TRIGGER_RISING|IRQF_TRIGGER_FALLING, 
-                            dev->irqkey[i].name, &keyinputdev);
+                            keydesc->name, keydesc);
         if(ret){
-            printk("irq %d request failed!\r\n", dev->irqkey[i].irqnum);
+            printk("irq %d request failed!\r\n", keydesc->irqnum);
             ret = -EINVAL;
-            goto fail_requset_irq;
+            goto fail_setup_gpio;
         }
     }
 
-    /* 初始化定时器 */
-    init_timer(&dev->timer); 
-    dev->timer.function = timer_func;
-
     /*注册input_dev*/
-
-    /*申请input_dev*/
-    dev->inputdev = input_allocate_device();
-    if(dev->inputdev == NULL){
-        ret = -EINVAL;
-        goto fail_alloc_input;
-    }
-
-    /*初始化inputdev*/
-    dev->inputdev->name = KEYINPUT_NAME;
-    __set_bit(EV_KEY, dev->inputdev->evbit);        /*按键事件*/
-    __set_bit(EV_REP, dev->inputdev->evbit);        /*重复事件*/
-    __set_bit(KEY_0, dev->inputdev->keybit);        /*按键值*/
-
-    /*注册*/
     ret = input_register_device(dev->inputdev);
     if(ret){
         goto fail_reg_inputdev;
     }
     return 0;
 
+fail_setup_gpio:
+    gpio_free(dev->irqkey[i].gpio);
+fail_get_gpio:
 fail_reg_inputdev:
+    /*释放已经初始化的按键*/
+    keyio_free(dev, i);
     input_free_device(dev->inputdev);
 fail_alloc_input:
-    /*删除定时器*/
-    del_timer_sync(&dev->timer);
-    /*释放中断*/
-    for(i = 0; i< KEY_NUM; i++){ 
-        free_irq(dev->irqkey[i].irqnum, &dev);
-    }
-fail_requset_irq:
-fail_setup_gpio:
-    /*释放key的GPIO*/
-    for(i = 0; i< KEY_NUM; i++){ 
-        gpio_free(dev->irqkey[i].gpio);
-    }    
-fail_reqs_gpio:    
-fail_get_gpio:    
-fail_get_nd:
+    kfree(dev->irqkey);
     return ret;
 }
 
@@ -198,21 +285,11 @@ static int __init mykey_init(void)
 
 static void __exit mykey_exit(void)
 {
-    int i = 0;
-    /*删除定时器*/
-    del_timer_sync(&keyinputdev.timer); 
-    /*释放中断*/
-    for(i = 0; i< KEY_NUM; i++){ 
-        free_irq(keyinputdev.irqkey[i].irqnum, &keyinputdev);
-    }
-    /*释放key的GPIO*/
-    for(i = 0; i< KEY_NUM; i++){ 
-        gpio_free(keyinputdev.irqkey[i].gpio);
-    }
-    /*注销input_dev*/
+    /*释放中断、定时器和GPIO*/
+    keyio_free(&keyinputdev, keyinputdev.keynum);
+    kfree(keyinputdev.irqkey);
+    /*注销input_dev, 注销时会释放input_dev, 不再调用input_free_device*/
     input_unregister_device(keyinputdev.inputdev);
-    /*释放input_dev*/
-    input_free_device(keyinputdev.inputdev);
     printk("key_exit()\r\n");
 }
 
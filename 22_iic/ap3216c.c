@@ -6,7 +6,6 @@
 #include <linux/module.h>
 #include <linux/errno.h>
 #include <linux/gpio.h>
-#include <asm/mach/map.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include <linux/cdev.h>
@@ -16,10 +15,44 @@
 #include <linux/device.h>
 #include <linux/input.h>
 #include <linux/i2c.h>
+#include <linux/regmap.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/interrupt.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/pm_runtime.h>
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+#include <linux/iio/iio.h>
+#include <linux/iio/sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#endif
 #include "ap3216creg.h"
+#include "ap3216cioctl.h"
 
 #define AP3216C_CNT       1
 #define AP3216C_NAME      "ap3216c"
+#define AP3216C_DATA_LEN  6           /*IR、ALS、PS数据寄存器0x0A~0x0F*/
+#define AP3216C_EVENT_LEN 16          /*事件环形缓冲区的事件个数, 必须为2的幂*/
+#define AP3216C_PS_MAX    1023        /*PS为10位*/
+
+#define AP3216C_MODE_OFF        0x00    /*SYSTEMCONG: 掉电, 其余工作模式见ap3216cioctl.h*/
+#define AP3216C_MODE_RESET      0x04    /*SYSTEMCONG: 软件复位*/
+#define AP3216C_AUTOSUSPEND_MS  2000    /*空闲多久后掉电, 可通过power/autosuspend_delay_ms修改*/
+#define AP3216C_ALS_GAIN_MASK   0x30    /*ALSCONFIG bit5:4, ALS量程*/
+#define AP3216C_ALS_GAIN_SHIFT  4
+
+/*
+ * 1: 一次突发读取全部6个数据寄存器, regmap根据适配器能力选择传输方式:
+ *    支持I2C_FUNC_I2C时为一次i2c_transfer, 只支持SMBus时为I2C块读, 都不支持时逐个读取
+ * 0: 逐个读取, 每个寄存器一次i2c_transfer, 用于对比测试
+ */
+static bool burst_read = true;
+module_param(burst_read, bool, 0644);
+MODULE_PARM_DESC(burst_read, "read the 6 data registers in one transfer");
 
 /*ap3216c设备结构体*/
 struct ap3216c_dev{
@@ -32,82 +65,115 @@ struct ap3216c_dev{
     unsigned short ir,ps,als;
 
     void *private_data;         /*私有数据域*/
-}; 
+    struct regmap *regmap;      /*寄存器访问, 缓存配置寄存器*/
 
-struct ap3216c_dev ap3216cdev;
+    struct mutex lock;          /*保护总线访问、users、samplers、period_ms和阈值*/
+    u8 mode;                    /*工作时SYSTEMCONG的值*/
+    int users;                  /*打开设备的文件个数, 有读者时芯片才工作*/
+    int samplers;               /*读取采样格式的文件个数*/
+    unsigned int period_ms;     /*采样周期, 0表示不后台采样*/
+    struct delayed_work work;   /*后台采样*/
+    seqlock_t seqlock;          /*保护cache, read()不会被采样阻塞*/
+    struct ap3216c_sample cache;    /*最近一次的采样*/
 
+    /*阈值事件, 所有读者共享, 每个文件有自己的读位置*/
+    int irq;                    /*INT引脚中断号, <=0表示没有中断, 由后台采样判断阈值*/
+    struct ap3216c_thresh thresh;   /*当前阈值*/
+    s8 als_zone, ps_zone;       /*上一次测量值相对阈值的位置*/
+    spinlock_t event_lock;      /*保护events和event_head*/
+    unsigned int event_head;    /*已产生的事件总数*/
+    struct ap3216c_event events[AP3216C_EVENT_LEN];
+    wait_queue_head_t r_wait;   /*等待事件的读者*/
 
-/*读取AP3216C的寄存器值*/
-static int ap3216c_read_reg(struct ap3216c_dev *dev, u8 reg, void *val, int len)
-{
-    struct i2c_msg msg[2];
-    struct i2c_client *client = (struct i2c_client *)dev->private_data;
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+    struct iio_dev *indio_dev;  /*IIO设备, 与字符设备同时存在*/
+#endif
+}; 
 
-    /*构建msg*/
-    /*第一步写入要读的寄存器地址*/
-    msg[0].addr = client->addr;             /*i2c设备地址*/
-    msg[0].flags = 0;                       /*写操作标志*/
-    msg[0].buf = &reg;                      /*要写入的数据，这里是寄存器地址*/
-    msg[0].len = 1;                         /*要写入的数据长度，这里寄存器地址是1个字节*/
+/*每个打开的文件的私有数据*/
+struct ap3216c_file{
+    struct ap3216c_dev *dev;    /*设备*/
+    int format;                 /*read()返回的数据格式*/
+    unsigned int tail;          /*下一个要读的事件序号, 受event_lock保护*/
+    unsigned int dropped;       /*读得太慢被覆盖的事件个数*/
+};
 
-    /*第二步发送要读的寄存器地址，并将读取到的值保存到msg.buf中*/
-    msg[1].addr = client->addr;             /*i2c设备地址*/             
-    msg[1].flags = I2C_M_RD;                /*读操作标志*/
-    msg[1].buf = val;                       /*将读出的数据保存在val中*/
-    msg[1].len = len;                       /*读出的数据长度*/
+struct ap3216c_dev ap3216cdev;
 
-    return i2c_transfer(client->adapter, msg, 2);
-}
 
-/*从寄存器读取一个数据*/
-static u8 ap3216c_readone(struct ap3216c_dev *dev, u8 reg)
+/*中断状态和数据寄存器每次都从芯片读取, 其余寄存器使用缓存*/
+static bool ap3216c_volatile_reg(struct device *dev, unsigned int reg)
 {
-    u8 data;
-    ap3216c_read_reg(dev, reg, &data, 1);
-    return data;
+    return reg == AP3216C_INTSTATUS ||
+           (reg >= AP3216C_IRDATALOW && reg <= AP3216C_PSDATAHIGH);
 }
 
+/*各工作模式一次转换的时间(ms)和需要读取的数据寄存器, 下标为SYSTEMCONG的值*/
+static const struct {
+    unsigned int conv_ms;
+    u8 reg;                     /*突发读取的起始寄存器*/
+    u8 len;                     /*突发读取的长度*/
+} ap3216c_modes[] = {
+    [AP3216C_MODE_ALS]   = { 100, AP3216C_ALSDATALOW, 2 },
+    /*IR和PS中间隔着ALS, 一次读6个字节比分两次各读2个字节的总线时间短*/
+    [AP3216C_MODE_PS_IR] = { 13,  AP3216C_IRDATALOW,  AP3216C_DATA_LEN },
+    [AP3216C_MODE_ALL]   = { 113, AP3216C_IRDATALOW,  AP3216C_DATA_LEN },
+};
 
-/*向AP3216C的寄存器写数据*/
-static int ap3216c_write_reg(struct ap3216c_dev *dev, u8 reg, u8 *buf, u8 len)
+static bool ap3216c_mode_valid(int mode)
 {
-    u8 buffer[256];
-    struct i2c_msg msg;
-    struct i2c_client *client = (struct i2c_client *)dev->private_data;
-
-    /*初始化写入数据包，数据的第一个字写为写入的地址*/
-    buffer[0] = reg;
-    memcpy(&buffer[1], buf, len);
+    return mode == AP3216C_MODE_ALS || mode == AP3216C_MODE_PS_IR || mode == AP3216C_MODE_ALL;
+}
 
-    /*构建msg*/
-    msg.addr = client->addr;             /*i2c设备地址*/
-    msg.flags = 0;                       /*写操作标志*/
-    msg.buf = buffer;                    /*要写入的数据, 寄存器地址+buf数据*/
-    msg.len = len + 1;                   /*要写入的数据长度*/
+static const struct regmap_config ap3216c_regmap_config = {
+    .reg_bits = 8,
+    .val_bits = 8,
+    .max_register = AP3216C_PSTHRHIGHH,
+    .volatile_reg = ap3216c_volatile_reg,
+    .cache_type = REGCACHE_RBTREE,
+};
 
-    return i2c_transfer(client->adapter, &msg, 1);
+/*从寄存器读取一个数据*/
+static u8 ap3216c_readone(struct ap3216c_dev *dev, u8 reg)
+{
+    unsigned int data = 0;
+    regmap_read(dev->regmap, reg, &data);
+    return data;
 }
 
 /*向寄存器写入一个数据*/
 static void ap3216c_writeone(struct ap3216c_dev *dev, u8 reg, u8 data)
 {
-    u8 buf;
-    buf = data;
-    ap3216c_write_reg(dev, reg, &buf, 1);
+    regmap_write(dev->regmap, reg, data);
 }
 
-/* AP3216C数据读取 */
+/*
+ * AP3216C数据读取, 只读取当前模式开启的通道, 结果放在dev->ir/als/ps中,
+ * 没有开启的通道为0, 调用者需持有dev->lock
+ */
 static void ap3216c_readdata(struct ap3216c_dev *dev)
 {
-    unsigned char buf[6];
+    unsigned char buf[AP3216C_DATA_LEN] = { 0 };
     unsigned char i = 0;
+    u8 reg = ap3216c_modes[dev->mode].reg;
+    u8 len = ap3216c_modes[dev->mode].len;
+    u8 *p = &buf[reg - AP3216C_IRDATALOW];     /*buf下标与寄存器0x0A~0x0F对应*/
 
-    /* 循环的读取数据 */
-    for(i = 0; i < 6; i++) {
-        buf[i] = ap3216c_readone(dev, AP3216C_IRDATALOW + i);
+    if(READ_ONCE(burst_read)) {
+        /* 数据寄存器地址连续, 一次读取 */
+        if(regmap_bulk_read(dev->regmap, reg, p, len) < 0)
+            memset(buf, 0, sizeof(buf));
+    } else {
+        /* 循环的读取数据, 跳过没有开启的ALS */
+        for(i = 0; i < len; i++) {
+            if(!(dev->mode & AP3216C_MODE_ALS) &&
+               reg + i >= AP3216C_ALSDATALOW && reg + i <= AP3216C_ALSDATAHIGH)
+                continue;
+            p[i] = ap3216c_readone(dev, reg + i);
+        }
     }
 
-    if(buf[0] & 0x80) { /* 为真表示IR和PS数据无效 */
+    if(!(dev->mode & AP3216C_MODE_PS_IR) || (buf[0] & 0x80)) { /* 没有开启或IR和PS数据无效 */
         dev->ir = 0;
         dev->ps = 0;
     } else {
@@ -115,55 +181,802 @@ static void ap3216c_readdata(struct ap3216c_dev *dev)
         dev->ps = (((unsigned short)buf[5] & 0x3F) << 4) | (buf[4] & 0x0F);
     }
 
-    dev->als  = ((unsigned short)buf[3] << 8) | buf[2]; 
+    if(dev->mode & AP3216C_MODE_ALS)
+        dev->als = ((unsigned short)buf[3] << 8) | buf[2];
+    else
+        dev->als = 0;
 }
 
-static int ap3216c_open (struct inode *inode, struct file *filp)
+/*
+* @description : 计算测量值相对阈值的位置
+*/
+static s8 ap3216c_zone(unsigned int value, unsigned int low, unsigned int high)
+{
+    if(value < low)
+        return AP3216C_ZONE_LOW;
+    if(value > high)
+        return AP3216C_ZONE_HIGH;
+    return AP3216C_ZONE_IN;
+}
+
+/*
+* @description : 按当前位置计算写入芯片的窗口, 芯片只在测量值超出窗口时产生中断,
+*                已经超出阈值时把窗口换成阈值外侧的一段, 回到阈值之内时也会产生中断
+* @param - zone : 当前位置
+* @param - max : 通道的最大值
+* @param - win : 返回窗口的低、高边界
+*/
+static void ap3216c_window(s8 zone, u16 low, u16 high, u16 max, u16 win[2])
+{
+    if(zone == AP3216C_ZONE_HIGH && high < max){
+        win[0] = high + 1;
+        win[1] = max;
+    }else if(zone == AP3216C_ZONE_LOW && low > 0){
+        win[0] = 0;
+        win[1] = low - 1;
+    }else{
+        win[0] = low;
+        win[1] = high;
+    }
+}
+
+/*
+* @description : 按阈值和当前位置将窗口写入芯片, 调用者需持有dev->lock
+* @param - dev : ap3216c设备
+* @return : 0 成功，<0 失败
+*/
+static int ap3216c_write_thresh(struct ap3216c_dev *dev)
+{
+    int ret;
+    u8 buf[4];
+    u16 win[2];
+    const struct ap3216c_thresh *t = &dev->thresh;
+
+    /*ALS阈值为16位, 低字节在前*/
+    ap3216c_window(dev->als_zone, t->als_low, t->als_high, 0xFFFF, win);
+    buf[0] = win[0] & 0xFF;
+    buf[1] = win[0] >> 8;
+    buf[2] = win[1] & 0xFF;
+    buf[3] = win[1] >> 8;
+    ret = regmap_bulk_write(dev->regmap, AP3216C_ALSTHRLOWL, buf, 4);
+    if(ret < 0)
+        return ret;
+
+    /*PS阈值为10位, 低字节存放bit1:0, 高字节存放bit9:2*/
+    ap3216c_window(dev->ps_zone, t->ps_low, t->ps_high, AP3216C_PS_MAX, win);
+    buf[0] = win[0] & 0x03;
+    buf[1] = win[0] >> 2;
+    buf[2] = win[1] & 0x03;
+    buf[3] = win[1] >> 2;
+    return regmap_bulk_write(dev->regmap, AP3216C_PSTHRLOWL, buf, 4);
+}
+
+/*
+* @description : 用最近一次的测量值判断是否越过阈值, 只有位置发生变化时才产生事件,
+*                每次采样都要判断, 有中断时位置变化后还要更新芯片中的窗口,
+*                调用者需持有dev->lock
+* @param - dev : ap3216c设备
+*/
+static void ap3216c_check_thresh(struct ap3216c_dev *dev)
+{
+    struct ap3216c_event *e;
+    s8 als_zone = dev->als_zone;
+    s8 ps_zone = dev->ps_zone;
+    u8 source = 0;
+
+    /*没有开启的通道保持原来的位置*/
+    if(dev->mode & AP3216C_MODE_ALS)
+        als_zone = ap3216c_zone(dev->als, dev->thresh.als_low, dev->thresh.als_high);
+    if(dev->mode & AP3216C_MODE_PS_IR)
+        ps_zone = ap3216c_zone(dev->ps, dev->thresh.ps_low, dev->thresh.ps_high);
+
+    if(als_zone != dev->als_zone)
+        source |= AP3216C_EVT_ALS;
+    if(ps_zone != dev->ps_zone)
+        source |= AP3216C_EVT_PS;
+    dev->als_zone = als_zone;
+    dev->ps_zone = ps_zone;
+    if(!source)
+        return;
+
+    spin_lock(&dev->event_lock);
+    e = &dev->events[dev->event_head & (AP3216C_EVENT_LEN - 1)];
+    memset(e, 0, sizeof(*e));
+    e->timestamp = ktime_get_ns();
+    e->ir = dev->ir;
+    e->als = dev->als;
+    e->ps = dev->ps;
+    e->source = source;
+    e->als_zone = als_zone;
+    e->ps_zone = ps_zone;
+    dev->event_head++;
+    spin_unlock(&dev->event_lock);
+
+    wake_up_interruptible(&dev->r_wait);
+
+    if(dev->irq > 0)
+        ap3216c_write_thresh(dev);
+}
+
+/*
+* @description : 读取一次数据, 更新缓存并判断阈值, 调用者需持有dev->lock
+* @param - dev : ap3216c设备
+*/
+static void ap3216c_sample(struct ap3216c_dev *dev)
+{
+    struct i2c_client *client = (struct i2c_client *)dev->private_data;
+
+    /*芯片掉电时先唤醒, 读完后空闲AP3216C_AUTOSUSPEND_MS再掉电*/
+    pm_runtime_get_sync(&client->dev);
+    ap3216c_readdata(dev);
+    pm_runtime_mark_last_busy(&client->dev);
+    pm_runtime_put_autosuspend(&client->dev);
+
+    write_seqlock(&dev->seqlock);
+    dev->cache.timestamp = ktime_get_ns();
+    dev->cache.seq++;
+    dev->cache.ir = dev->ir;
+    dev->cache.als = dev->als;
+    dev->cache.ps = dev->ps;
+    write_sequnlock(&dev->seqlock);
+
+    ap3216c_check_thresh(dev);
+}
+
+/*
+* @description : 从环形缓冲区取一个事件, 读得太慢时跳过被覆盖的事件
+* @return : true 取到一个事件, false 没有新事件
+*/
+static bool ap3216c_event_get(struct ap3216c_dev *dev, struct ap3216c_file *priv,
+                              struct ap3216c_event *e)
+{
+    bool ret = false;
+
+    spin_lock(&dev->event_lock);
+    if(dev->event_head - priv->tail > AP3216C_EVENT_LEN){
+        priv->dropped += dev->event_head - priv->tail - AP3216C_EVENT_LEN;
+        priv->tail = dev->event_head - AP3216C_EVENT_LEN;
+    }
+    if(priv->tail != dev->event_head){
+        *e = dev->events[priv->tail & (AP3216C_EVENT_LEN - 1)];
+        priv->tail++;
+        ret = true;
+    }
+    spin_unlock(&dev->event_lock);
+    return ret;
+}
+
+static bool ap3216c_event_avail(struct ap3216c_dev *dev, struct ap3216c_file *priv)
+{
+    return READ_ONCE(dev->event_head) != READ_ONCE(priv->tail);
+}
+
+/*
+* @description : INT引脚中断线程, 读取数据判断阈值, 然后清除中断
+*/
+static irqreturn_t ap3216c_irq_thread(int irq, void *dev_id)
+{
+    unsigned int status = 0;
+    struct ap3216c_dev *dev = dev_id;
+
+    mutex_lock(&dev->lock);
+    regmap_read(dev->regmap, AP3216C_INTSTATUS, &status);
+    if(status & (AP3216C_INT_ALS | AP3216C_INT_PS)){
+        ap3216c_sample(dev);
+        regmap_write(dev->regmap, AP3216C_INTSTATUS, status);  /* 写1清除 */
+    }
+    mutex_unlock(&dev->lock);
+
+    return status ? IRQ_HANDLED : IRQ_NONE;
+}
+
+/*
+* @description : 是否需要后台采样: 有读取采样格式的文件, 或者没有中断时靠采样判断阈值,
+*                调用者需持有dev->lock
+*/
+static bool ap3216c_sampler_needed(struct ap3216c_dev *dev)
+{
+    if(!dev->period_ms)
+        return false;
+    return dev->irq > 0 ? dev->samplers > 0 : dev->users > 0;
+}
+
+/*
+* @description : 根据当前的读者开始或停止后台采样, 开始时立即采样一次,
+*                不用等一个周期后才有数据, 调用者需持有dev->lock
+*/
+static void ap3216c_sampler_update(struct ap3216c_dev *dev)
 {
+    if(ap3216c_sampler_needed(dev)){
+        if(!delayed_work_pending(&dev->work))
+            mod_delayed_work(system_wq, &dev->work, 0);
+    }else{
+        cancel_delayed_work(&dev->work);    /*正在运行的ap3216c_work会自己停止*/
+    }
+}
+
+/*后台采样, 每period_ms读取一次芯片, 读者个数不影响总线上的访问次数*/
+static void ap3216c_work(struct work_struct *work)
+{
+    struct ap3216c_dev *dev = container_of(to_delayed_work(work), struct ap3216c_dev, work);
+
+    mutex_lock(&dev->lock);
+    if(ap3216c_sampler_needed(dev)){
+        ap3216c_sample(dev);
+        schedule_delayed_work(&dev->work, msecs_to_jiffies(dev->period_ms));
+    }
+    mutex_unlock(&dev->lock);
+}
+
+/*AP3216C传感器初始化, 只在probe时执行一次*/
+static int ap3216c_chip_init(struct ap3216c_dev *dev)
+{
+    int ret;
     u8 value = 0;
-    filp->private_data = &ap3216cdev;
-    printk("ap3216c_open\r\n");
 
-    /*AP3216C传感器初始化 */
-    ap3216c_writeone(&ap3216cdev, AP3216C_SYSTEMCONG, 0X4); /* 复位 */
-    mdelay(50);
-    ap3216c_writeone(&ap3216cdev, AP3216C_SYSTEMCONG, 0X3); /* 复位 */
-    value = ap3216c_readone(&ap3216cdev, AP3216C_SYSTEMCONG);
+    ret = regmap_write(dev->regmap, AP3216C_SYSTEMCONG, AP3216C_MODE_RESET); /* 复位 */
+    if(ret < 0)
+        return ret;
+    msleep(50);
+    regcache_drop_region(dev->regmap, 0, AP3216C_PSTHRHIGHH);   /* 复位后缓存失效 */
+    ap3216c_writeone(dev, AP3216C_SYSTEMCONG, dev->mode);
+    value = ap3216c_readone(dev, AP3216C_SYSTEMCONG);
     printk("ap3216c system config reg=%#x\r\n", value);
+
+    /*阈值中断: 区间方式, 写1清除, 复位后重新判断位置*/
+    ap3216c_writeone(dev, AP3216C_INTCLEAR, AP3216C_INT_CLR_SW);
+    ap3216c_writeone(dev, AP3216C_PSINTFORM, 0x00);
+    dev->als_zone = AP3216C_ZONE_IN;
+    dev->ps_zone = AP3216C_ZONE_IN;
+    return ap3216c_write_thresh(dev);
+}
+
+/*空闲超时后掉电, 阈值等配置寄存器在掉电时保持不变*/
+static int __maybe_unused ap3216c_runtime_suspend(struct device *device)
+{
+    struct ap3216c_dev *dev = &ap3216cdev;
+
+    return regmap_write(dev->regmap, AP3216C_SYSTEMCONG, AP3216C_MODE_OFF);
+}
+
+/*重新上电后等待一次转换完成, 保证读到的是新数据*/
+static int __maybe_unused ap3216c_runtime_resume(struct device *device)
+{
+    int ret;
+    struct ap3216c_dev *dev = &ap3216cdev;
+
+    ret = regmap_write(dev->regmap, AP3216C_SYSTEMCONG, dev->mode);
+    if(ret < 0)
+        return ret;
+    msleep(ap3216c_modes[dev->mode].conv_ms);
     return 0;
 }
 
-static ssize_t ap3216c_read (struct file *filp, char __user *buf, size_t cnt, loff_t *off_t)
+static const struct dev_pm_ops ap3216c_pm_ops = {
+    SET_RUNTIME_PM_OPS(ap3216c_runtime_suspend, ap3216c_runtime_resume, NULL)
+};
+
+/*
+* @description : 切换工作模式, 只转换开启的通道, 缩短转换周期
+* @param - dev : ap3216c设备
+* @param - mode : AP3216C_MODE_xxx
+* @return : 0 成功，<0 失败
+*/
+static int ap3216c_set_mode(struct ap3216c_dev *dev, int mode)
+{
+    int ret;
+    struct i2c_client *client = (struct i2c_client *)dev->private_data;
+
+    if(!ap3216c_mode_valid(mode))
+        return -EINVAL;
+
+    mutex_lock(&dev->lock);
+    pm_runtime_get_sync(&client->dev);
+    dev->mode = mode;
+    ret = regmap_write(dev->regmap, AP3216C_SYSTEMCONG, mode);
+    pm_runtime_mark_last_busy(&client->dev);
+    pm_runtime_put_autosuspend(&client->dev);
+    mutex_unlock(&dev->lock);
+    return ret;
+}
+
+/*
+* @description : 阈值事件需要芯片一直工作, 有读取事件的文件时保持上电
+* @param - dev : ap3216c设备
+* @param - on : true 开始读取事件, false 停止读取事件
+*/
+static void ap3216c_event_hold(struct ap3216c_dev *dev, bool on)
+{
+    struct i2c_client *client = (struct i2c_client *)dev->private_data;
+
+    if(on){
+        pm_runtime_get_sync(&client->dev);
+    }else{
+        pm_runtime_mark_last_busy(&client->dev);
+        pm_runtime_put_autosuspend(&client->dev);
+    }
+}
+
+static int ap3216c_open (struct inode *inode, struct file *filp)
+{
+    struct ap3216c_file *priv;
+    struct ap3216c_dev *dev = &ap3216cdev;
+
+    priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+    if(!priv)
+        return -ENOMEM;
+    priv->dev = dev;
+    priv->format = AP3216C_FMT_SAMPLE;
+    filp->private_data = priv;
+    printk("ap3216c_open\r\n");
+
+    /*芯片已在probe时初始化, 打开时不访问总线, 第一次读取时才上电*/
+    mutex_lock(&dev->lock);
+    dev->users++;
+    dev->samplers++;
+    priv->tail = dev->event_head;           /*只读取打开之后的事件*/
+    ap3216c_sampler_update(dev);
+    mutex_unlock(&dev->lock);
+    return 0;
+}
+
+/*读取一个采样, 不会阻塞*/
+static ssize_t ap3216c_read_sample(struct ap3216c_dev *dev, char __user *buf, size_t cnt)
 {
     short data[3];
     long err = 0;
-    struct ap3216c_dev *dev = (struct ap3216c_dev *)filp->private_data;
+    unsigned int seq;
+    struct ap3216c_sample s;
 
-    ap3216c_readdata(dev);
+    /*不后台采样, 或者后台采样还没有完成第一次读取时直接读取芯片*/
+    if(!READ_ONCE(dev->period_ms) || !READ_ONCE(dev->cache.seq)){
+        mutex_lock(&dev->lock);
+        if(!dev->period_ms || !dev->cache.seq)
+            ap3216c_sample(dev);
+        mutex_unlock(&dev->lock);
+    }
+
+    /*读取缓存, 与后台采样冲突时重试, 不会阻塞, 结构体末尾的补齐字节也要清零*/
+    memset(&s, 0, sizeof(s));
+    do{
+        seq = read_seqbegin(&dev->seqlock);
+        s = dev->cache;
+    }while(read_seqretry(&dev->seqlock, seq));
+    s.age_ns = s.timestamp ? ktime_get_ns() - s.timestamp : 0;
+
+    if(cnt >= sizeof(s)){
+        if(copy_to_user(buf, &s, sizeof(s)))
+            return -EFAULT;
+        return sizeof(s);
+    }
 
-    data[0] = dev->ir;
-    data[1] = dev->als;
-    data[2] = dev->ps;
-    // printk("driver ir = %d, als = %d, ps = %d\r\n", dev->ir, dev->als, dev->ps);
+    /*旧格式*/
+    data[0] = s.ir;
+    data[1] = s.als;
+    data[2] = s.ps;
+    // printk("driver ir = %d, als = %d, ps = %d\r\n", s.ir, s.als, s.ps);
 
     err = copy_to_user(buf, data, sizeof(data));
 
     return 0;
 }
 
+/*读取阈值事件, 没有事件时阻塞, 返回缓冲区能容纳的所有事件*/
+static ssize_t ap3216c_read_event(struct ap3216c_dev *dev, struct ap3216c_file *priv,
+                                  struct file *filp, char __user *buf, size_t cnt)
+{
+    int ret;
+    size_t done = 0;
+    struct ap3216c_event e;
+
+    if(cnt < sizeof(e))
+        return -EINVAL;
+
+    while(done + sizeof(e) <= cnt){
+        if(!ap3216c_event_get(dev, priv, &e)){
+            if(done)
+                break;
+            if(filp->f_flags & O_NONBLOCK)
+                return -EAGAIN;
+            ret = wait_event_interruptible(dev->r_wait, ap3216c_event_avail(dev, priv));
+            if(ret)
+                return ret;
+            continue;
+        }
+        if(copy_to_user(buf + done, &e, sizeof(e)))
+            return -EFAULT;
+        done += sizeof(e);
+    }
+    return done;
+}
+
+static ssize_t ap3216c_read (struct file *filp, char __user *buf, size_t cnt, loff_t *off_t)
+{
+    struct ap3216c_file *priv = filp->private_data;
+
+    if(priv->format == AP3216C_FMT_EVENT)
+        return ap3216c_read_event(priv->dev, priv, filp, buf, cnt);
+    return ap3216c_read_sample(priv->dev, buf, cnt);
+}
+
+static unsigned int ap3216c_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    struct ap3216c_file *priv = filp->private_data;
+    struct ap3216c_dev *dev = priv->dev;
+
+    /*采样格式随时可读*/
+    if(priv->format != AP3216C_FMT_EVENT)
+        return POLLIN | POLLRDNORM;
+
+    poll_wait(filp, &dev->r_wait, wait);
+    if(ap3216c_event_avail(dev, priv))
+        return POLLIN | POLLRDNORM;
+    return 0;
+}
+
+static long ap3216c_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    int value;
+    long ret = 0;
+    struct ap3216c_thresh thresh;
+    struct ap3216c_file *priv = filp->private_data;
+    struct ap3216c_dev *dev = priv->dev;
+
+    switch(cmd){
+        case AP3216C_SET_PERIOD:
+            if(copy_from_user(&value, (int __user *)arg, sizeof(int)))
+                return -EFAULT;
+            if(value < 0)
+                return -EINVAL;
+            mutex_lock(&dev->lock);
+            dev->period_ms = value;
+            if(ap3216c_sampler_needed(dev))
+                mod_delayed_work(system_wq, &dev->work, 0);
+            mutex_unlock(&dev->lock);
+            break;
+        case AP3216C_GET_PERIOD:
+            value = READ_ONCE(dev->period_ms);
+            if(copy_to_user((int __user *)arg, &value, sizeof(int)))
+                return -EFAULT;
+            break;
+        case AP3216C_SET_THRESH:
+            if(copy_from_user(&thresh, (void __user *)arg, sizeof(thresh)))
+                return -EFAULT;
+            if(thresh.als_low > thresh.als_high || thresh.ps_low > thresh.ps_high ||
+               thresh.ps_high > AP3216C_PS_MAX)
+                return -EINVAL;
+            mutex_lock(&dev->lock);
+            dev->thresh = thresh;
+            ret = ap3216c_write_thresh(dev);        /*掉电时也可以写配置寄存器*/
+            mutex_unlock(&dev->lock);
+            break;
+        case AP3216C_GET_THRESH:
+            mutex_lock(&dev->lock);
+            thresh = dev->thresh;
+            mutex_unlock(&dev->lock);
+            if(copy_to_user((void __user *)arg, &thresh, sizeof(thresh)))
+                return -EFAULT;
+            break;
+        case AP3216C_SET_FORMAT:
+            if(copy_from_user(&value, (int __user *)arg, sizeof(int)))
+                return -EFAULT;
+            if(value != AP3216C_FMT_SAMPLE && value != AP3216C_FMT_EVENT)
+                return -EINVAL;
+            mutex_lock(&dev->lock);
+            if(value != priv->format){
+                dev->samplers += value == AP3216C_FMT_SAMPLE ? 1 : -1;
+                priv->format = value;
+                ap3216c_event_hold(dev, value == AP3216C_FMT_EVENT);
+                ap3216c_sampler_update(dev);
+            }
+            mutex_unlock(&dev->lock);
+            break;
+        case AP3216C_GET_FORMAT:
+            if(copy_to_user((int __user *)arg, &priv->format, sizeof(int)))
+                return -EFAULT;
+            break;
+        case AP3216C_SET_MODE:
+            if(copy_from_user(&value, (int __user *)arg, sizeof(int)))
+                return -EFAULT;
+            ret = ap3216c_set_mode(dev, value);
+            break;
+        case AP3216C_GET_MODE:
+            value = READ_ONCE(dev->mode);
+            if(copy_to_user((int __user *)arg, &value, sizeof(int)))
+                return -EFAULT;
+            break;
+        case AP3216C_GET_DROPPED:
+            spin_lock(&dev->event_lock);
+            value = priv->dropped;
+            spin_unlock(&dev->event_lock);
+            if(copy_to_user((int __user *)arg, &value, sizeof(int)))
+                return -EFAULT;
+            break;
+        default:
+            return -ENOTTY;
+    }
+    return ret;
+}
+
 static int ap3216c_release (struct inode *inode, struct file *filp)
 {
+    struct ap3216c_file *priv = filp->private_data;
+    struct ap3216c_dev *dev = priv->dev;
+
+    /*没有读者时停止后台采样*/
+    mutex_lock(&dev->lock);
+    dev->users--;
+    if(priv->format == AP3216C_FMT_SAMPLE)
+        dev->samplers--;
+    else
+        ap3216c_event_hold(dev, false);
+    ap3216c_sampler_update(dev);
+    mutex_unlock(&dev->lock);
+
+    kfree(priv);
     printk("ap3216c_release\r\n");
     return 0;
 }
+
+/*工作模式: 1 只有ALS, 2 只有PS+IR, 3 全部*/
+static ssize_t mode_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct ap3216c_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u\n", READ_ONCE(dev->mode));
+}
+
+static ssize_t mode_store(struct device *device, struct device_attribute *attr,
+                          const char *buf, size_t count)
+{
+    int ret;
+    int mode;
+    struct ap3216c_dev *dev = dev_get_drvdata(device);
+
+    ret = kstrtoint(buf, 0, &mode);
+    if(ret)
+        return ret;
+    ret = ap3216c_set_mode(dev, mode);
+    if(ret < 0)
+        return ret;
+    return count;
+}
+
+static DEVICE_ATTR_RW(mode);
+
+static struct attribute *ap3216c_attrs[] = {
+    &dev_attr_mode.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(ap3216c);
+
 /*字符设备操作集*/
 static struct file_operations ap3216c_fops = {
     .owner	 = THIS_MODULE,
     .open	 = ap3216c_open,
     .read	 = ap3216c_read,
+    .poll    = ap3216c_poll,
+    .unlocked_ioctl = ap3216c_ioctl,
     .release = ap3216c_release
 };
 
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+/*
+ * IIO接口, 在/sys/bus/iio/devices/iio:deviceX下:
+ *     in_intensity_ir_raw、in_illuminance_raw、in_proximity_raw  单次读取
+ *     in_illuminance_scale                                        lux/count, 写入时切换ALS量程
+ * 缓冲读取需要指定触发器, 可以和其他传感器共用一个, 例如:
+ *     echo 1 > scan_elements/in_illuminance_en
+ *     echo 1 > scan_elements/in_timestamp_en
+ *     cat trigger0/name > trigger/current_trigger
+ *     echo 1 > buffer/enable; cat /dev/iio:deviceX
+ */
+enum ap3216c_scan {
+    AP3216C_SCAN_IR,
+    AP3216C_SCAN_ALS,
+    AP3216C_SCAN_PS,
+    AP3216C_SCAN_TIMESTAMP,
+};
+
+/*ALS四个量程的lux/count, 即满量程(20661、5162、1291、323lux)/65535, 单位为百万分之一*/
+static const int ap3216c_als_scale[] = { 315266, 78767, 19699, 4929 };
+
+static IIO_CONST_ATTR(in_illuminance_scale_available, "0.315266 0.078767 0.019699 0.004929");
+
+static struct attribute *ap3216c_iio_attributes[] = {
+    &iio_const_attr_in_illuminance_scale_available.dev_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group ap3216c_iio_attribute_group = {
+    .attrs = ap3216c_iio_attributes,
+};
+
+static const struct iio_chan_spec ap3216c_channels[] = {
+    {
+        .type = IIO_INTENSITY,
+        .modified = 1,
+        .channel2 = IIO_MOD_LIGHT_IR,
+        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW),
+        .scan_index = AP3216C_SCAN_IR,
+        .scan_type = {
+            .sign = 'u',
+            .realbits = 10,
+            .storagebits = 16,
+            .endianness = IIO_CPU,
+        },
+    },
+    {
+        .type = IIO_LIGHT,
+        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE),
+        .scan_index = AP3216C_SCAN_ALS,
+        .scan_type = {
+            .sign = 'u',
+            .realbits = 16,
+            .storagebits = 16,
+            .endianness = IIO_CPU,
+        },
+    },
+    {
+        .type = IIO_PROXIMITY,
+        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW),
+        .scan_index = AP3216C_SCAN_PS,
+        .scan_type = {
+            .sign = 'u',
+            .realbits = 10,
+            .storagebits = 16,
+            .endianness = IIO_CPU,
+        },
+    },
+    IIO_CHAN_SOFT_TIMESTAMP(AP3216C_SCAN_TIMESTAMP),
+};
+
+/*按通道取最近一次读取的数据, 调用者需持有dev->lock*/
+static u16 ap3216c_chan_value(struct ap3216c_dev *dev, int scan_index)
+{
+    switch(scan_index){
+        case AP3216C_SCAN_IR:
+            return dev->ir;
+        case AP3216C_SCAN_ALS:
+            return dev->als;
+        default:
+            return dev->ps;
+    }
+}
+
+static int ap3216c_iio_read_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+                                int *val, int *val2, long mask)
+{
+    int ret;
+    unsigned int config;
+    struct ap3216c_dev *dev = *(struct ap3216c_dev **)iio_priv(indio_dev);
+
+    switch(mask){
+        case IIO_CHAN_INFO_RAW:
+            /*与缓冲读取、字符设备共用dev->lock, 缓冲读取期间也可以单次读取*/
+            mutex_lock(&dev->lock);
+            if(!(dev->mode & (chan->type == IIO_LIGHT ? AP3216C_MODE_ALS : AP3216C_MODE_PS_IR))){
+                mutex_unlock(&dev->lock);
+                return -EBUSY;      /*当前工作模式没有开启该通道*/
+            }
+            ap3216c_sample(dev);
+            *val = ap3216c_chan_value(dev, chan->scan_index);
+            mutex_unlock(&dev->lock);
+            return IIO_VAL_INT;
+        case IIO_CHAN_INFO_SCALE:
+            ret = regmap_read(dev->regmap, AP3216C_ALSCONFIG, &config);
+            if(ret < 0)
+                return ret;
+            *val = 0;
+            *val2 = ap3216c_als_scale[(config & AP3216C_ALS_GAIN_MASK) >> AP3216C_ALS_GAIN_SHIFT];
+            return IIO_VAL_INT_PLUS_MICRO;
+        default:
+            return -EINVAL;
+    }
+}
+
+static int ap3216c_iio_write_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+                                 int val, int val2, long mask)
+{
+    int i;
+    struct ap3216c_dev *dev = *(struct ap3216c_dev **)iio_priv(indio_dev);
+
+    if(mask != IIO_CHAN_INFO_SCALE || chan->type != IIO_LIGHT || val != 0)
+        return -EINVAL;
+
+    for(i = 0; i < ARRAY_SIZE(ap3216c_als_scale); i++){
+        if(ap3216c_als_scale[i] == val2)
+            return regmap_update_bits(dev->regmap, AP3216C_ALSCONFIG, AP3216C_ALS_GAIN_MASK,
+                                      i << AP3216C_ALS_GAIN_SHIFT);
+    }
+    return -EINVAL;
+}
+
+static const struct iio_info ap3216c_iio_info = {
+    .driver_module = THIS_MODULE,
+    .read_raw = ap3216c_iio_read_raw,
+    .write_raw = ap3216c_iio_write_raw,
+    .attrs = &ap3216c_iio_attribute_group,
+};
+
+/*
+* @description : 触发器的下半部, 读取一次数据, 只把使能的通道推入缓冲区,
+*                时间戳为触发器上半部iio_pollfunc_store_time记录的时刻
+*/
+static irqreturn_t ap3216c_trigger_handler(int irq, void *p)
+{
+    int i = 0;
+    int bit;
+    struct iio_poll_func *pf = p;
+    struct iio_dev *indio_dev = pf->indio_dev;
+    struct ap3216c_dev *dev = *(struct ap3216c_dev **)iio_priv(indio_dev);
+    u16 buf[8] __aligned(8);    /*3个通道共6字节, 补齐到8字节后放时间戳*/
+
+    memset(buf, 0, sizeof(buf));    /*没有使能的通道和补齐的字节不能带出内核栈的内容*/
+    mutex_lock(&dev->lock);
+    ap3216c_sample(dev);
+    for_each_set_bit(bit, indio_dev->active_scan_mask, indio_dev->masklength)
+        buf[i++] = ap3216c_chan_value(dev, bit);
+    mutex_unlock(&dev->lock);
+
+    iio_push_to_buffers_with_timestamp(indio_dev, buf, pf->timestamp);
+    iio_trigger_notify_done(indio_dev->trig);
+    return IRQ_HANDLED;
+}
+
+/*
+* @description : 注册IIO设备
+* @param - client : i2c设备
+* @param - dev : ap3216c设备
+* @return : 0 成功，<0 失败
+*/
+static int ap3216c_iio_register(struct i2c_client *client, struct ap3216c_dev *dev)
+{
+    int ret;
+    struct iio_dev *indio_dev;
+
+    indio_dev = devm_iio_device_alloc(&client->dev, sizeof(dev));
+    if(!indio_dev)
+        return -ENOMEM;
+    *(struct ap3216c_dev **)iio_priv(indio_dev) = dev;
+
+    indio_dev->dev.parent = &client->dev;
+    indio_dev->name = AP3216C_NAME;
+    indio_dev->info = &ap3216c_iio_info;
+    indio_dev->modes = INDIO_DIRECT_MODE;
+    indio_dev->channels = ap3216c_channels;
+    indio_dev->num_channels = ARRAY_SIZE(ap3216c_channels);
+
+    ret = iio_triggered_buffer_setup(indio_dev, iio_pollfunc_store_time,
+                                     ap3216c_trigger_handler, NULL);
+    if(ret < 0)
+        return ret;
+
+    ret = iio_device_register(indio_dev);
+    if(ret < 0){
+        iio_triggered_buffer_cleanup(indio_dev);
+        return ret;
+    }
+    dev->indio_dev = indio_dev;
+    return 0;
+}
+
+static void ap3216c_iio_unregister(struct ap3216c_dev *dev)
+{
+    iio_device_unregister(dev->indio_dev);
+    iio_triggered_buffer_cleanup(dev->indio_dev);
+}
+#else
+/*内核没有配置IIO触发缓冲区时只提供字符设备*/
+static int ap3216c_iio_register(struct i2c_client *client, struct ap3216c_dev *dev)
+{
+    return 0;
+}
+
+static void ap3216c_iio_unregister(struct ap3216c_dev *dev)
+{
+}
+#endif
+
 /*传统匹配表*/
 static const struct i2c_device_id ap3216c_id_table[] = {
 	{ "alk,ap3216c", 0 },
@@ -182,6 +995,61 @@ static int ap3216c_probe(struct i2c_client *client, const struct i2c_device_id *
     int ret = 0;
     printk("ap3216c_probe!\r\n");
 
+    mutex_init(&ap3216cdev.lock);
+    seqlock_init(&ap3216cdev.seqlock);
+    INIT_DELAYED_WORK(&ap3216cdev.work, ap3216c_work);
+    ap3216cdev.period_ms = AP3216C_DEFAULT_PERIOD_MS;
+    ap3216cdev.mode = AP3216C_MODE_ALL;
+    ap3216cdev.private_data = client;           /*将client数据保存在设备私有数据域中*/
+    spin_lock_init(&ap3216cdev.event_lock);
+    init_waitqueue_head(&ap3216cdev.r_wait);
+    /*默认阈值为整个量程, 不产生事件*/
+    ap3216cdev.thresh.als_low = 0;
+    ap3216cdev.thresh.als_high = 0xFFFF;
+    ap3216cdev.thresh.ps_low = 0;
+    ap3216cdev.thresh.ps_high = AP3216C_PS_MAX;
+
+    /*寄存器映射, 寄存器可在/sys/kernel/debug/regmap/<i2c设备名>/registers中查看*/
+    ap3216cdev.regmap = devm_regmap_init_i2c(client, &ap3216c_regmap_config);
+    if(IS_ERR(ap3216cdev.regmap))
+        return PTR_ERR(ap3216cdev.regmap);
+
+    if(i2c_check_functionality(client->adapter, I2C_FUNC_I2C))
+        printk("ap3216c: burst read with i2c_transfer\r\n");
+    else if(i2c_check_functionality(client->adapter, I2C_FUNC_SMBUS_I2C_BLOCK))
+        printk("ap3216c: burst read with smbus i2c block\r\n");
+    else
+        printk("ap3216c: adapter can't burst, read register by register\r\n");
+
+    /*复位并初始化芯片, 之后由runtime PM在空闲时掉电*/
+    ret = ap3216c_chip_init(&ap3216cdev);
+    if(ret < 0){
+        printk("ap3216c init failed!\r\n");
+        return ret;
+    }
+    pm_runtime_set_active(&client->dev);
+    pm_runtime_set_autosuspend_delay(&client->dev, AP3216C_AUTOSUSPEND_MS);
+    pm_runtime_use_autosuspend(&client->dev);
+    pm_runtime_enable(&client->dev);
+    pm_runtime_mark_last_busy(&client->dev);
+
+    /*
+     * 设备树中有interrupts属性时使用INT引脚的阈值中断, 否则由后台采样判断阈值, 例如:
+     *     interrupt-parent = <&gpio1>;
+     *     interrupts = <1 IRQ_TYPE_LEVEL_LOW>;
+     * INT为低电平有效, 中断线程清除中断前一直保持低电平
+     */
+    ap3216cdev.irq = client->irq;
+    if(ap3216cdev.irq > 0){
+        ret = devm_request_threaded_irq(&client->dev, ap3216cdev.irq, NULL, ap3216c_irq_thread,
+                                        IRQF_TRIGGER_LOW | IRQF_ONESHOT, AP3216C_NAME, &ap3216cdev);
+        if(ret < 0){
+            printk("irq %d request failed!\r\n", ap3216cdev.irq);
+            goto fail_devid;
+        }
+        printk("ap3216c: threshold irq = %d\r\n", ap3216cdev.irq);
+    }
+
     /*注册字符设备驱动*/
     ap3216cdev.major = 0;   /*设置主设备号为0，确保让系统分配设备号*/
     /*1、创建设备号*/
@@ -221,18 +1089,27 @@ static int ap3216c_probe(struct i2c_client *client, const struct i2c_device_id *
         goto fail_class;
     }
     /*5、创建设备*/
-    ap3216cdev.device = device_create(ap3216cdev.class, NULL, ap3216cdev.devid, NULL, AP3216C_NAME);
+    ap3216cdev.device = device_create_with_groups(ap3216cdev.class, &client->dev, ap3216cdev.devid,
+                                                  &ap3216cdev, ap3216c_groups, AP3216C_NAME);
     if(IS_ERR(ap3216cdev.device))
     {
         ret = PTR_ERR(ap3216cdev.device);
         goto fail_device;
     }
 
-    ap3216cdev.private_data = client;           /*将client数据保存在设备私有数据域中*/
+    /*6、注册IIO设备*/
+    ret = ap3216c_iio_register(client, &ap3216cdev);
+    if(ret < 0)
+    {
+        printk("ap3216c iio register failed!\r\n");
+        goto fail_iio;
+    }
 
     printk("ap3216cdev init()\r\n");
     return 0;
 
+fail_iio:
+    device_destroy(ap3216cdev.class, ap3216cdev.devid);
 fail_device:
     class_destroy(ap3216cdev.class);
 fail_class:
@@ -240,11 +1117,21 @@ fail_class:
 fail_cdev:
     unregister_chrdev_region(ap3216cdev.devid, AP3216C_CNT);   
 fail_devid:
+    pm_runtime_disable(&client->dev);
+    pm_runtime_set_suspended(&client->dev);
     return ret;
 }
 
 static int ap3216c_remove(struct i2c_client *client)
 {
+    ap3216c_iio_unregister(&ap3216cdev);
+    cancel_delayed_work_sync(&ap3216cdev.work);
+
+    /*关闭runtime PM后芯片保持当前状态, 卸载前掉电*/
+    pm_runtime_disable(&client->dev);
+    pm_runtime_set_suspended(&client->dev);
+    regmap_write(ap3216cdev.regmap, AP3216C_SYSTEMCONG, AP3216C_MODE_OFF);
+
     /*注销设备驱动*/
     cdev_del(&ap3216cdev.cdev);
     unregister_chrdev_region(ap3216cdev.devid, AP3216C_CNT);
@@ -260,6 +1147,7 @@ static struct i2c_driver ap3216c_driver = {
 		.name = "ap3216c",
 		.owner = THIS_MODULE,
         .of_match_table = ap3216c_of_match,
+        .pm = &ap3216c_pm_ops,
 	},
 	.probe = ap3216c_probe,
 	.remove = ap3216c_remove,
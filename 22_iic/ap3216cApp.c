@@ -2,10 +2,54 @@
 #include "unistd.h"
 #include "sys/types.h"
 #include "sys/stat.h"
+#include "sys/ioctl.h"
+#include "poll.h"
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "ap3216cioctl.h"
 
+/*
+ * 使用方法:
+ *     ./ap3216cApp /dev/ap3216c                    每200ms读取一次数据
+ *     ./ap3216cApp /dev/ap3216c ps_low ps_high     等待PS越过阈值的事件
+ */
+
+/*等待阈值事件, 空闲时不占用CPU和I2C总线*/
+static int wait_events(int fd, int ps_low, int ps_high)
+{
+    int format = AP3216C_FMT_EVENT;
+    struct ap3216c_thresh thresh;
+    struct ap3216c_event event;
+    struct pollfd fds;
+
+    if(ioctl(fd, AP3216C_GET_THRESH, &thresh) < 0)
+        return -1;
+    thresh.ps_low = ps_low;
+    thresh.ps_high = ps_high;
+    if(ioctl(fd, AP3216C_SET_THRESH, &thresh) < 0 ||
+       ioctl(fd, AP3216C_SET_FORMAT, &format) < 0)
+    {
+        printf("set threshold failed!\r\n");
+        return -1;
+    }
+
+    fds.fd = fd;
+    fds.events = POLLIN;
+    while(1){
+        if(poll(&fds, 1, -1) <= 0)
+            continue;
+        if(read(fd, &event, sizeof(event)) != sizeof(event))
+            continue;
+        if(event.source & AP3216C_EVT_PS)
+            printf("ps = %d, %s\r\n", event.ps,
+                   event.ps_zone == AP3216C_ZONE_HIGH ? "near" :
+                   event.ps_zone == AP3216C_ZONE_LOW ? "far" : "between");
+        if(event.source & AP3216C_EVT_ALS)
+            printf("als = %d\r\n", event.als);
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {   
@@ -14,7 +58,7 @@ int main(int argc, char *argv[])
     unsigned short data[3];
     unsigned short ir,als,ps;
 
-    if(argc != 2)
+    if(argc != 2 && argc != 4)
     {
         printf("Error param!\r\n");
         return -1;
@@ -29,6 +73,12 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if(argc == 4){
+        err = wait_events(fd, atoi(argv[2]), atoi(argv[3]));
+        close(fd);
+        return err;
+    }
+
     while(1){
         err = read(fd, data, sizeof(data));
         if(err == 0) {
@@ -48,4 +98,4 @@ int main(int argc, char *argv[])
         return -1;
     }
     return 0;
-}
\ No newline at end of file
+}
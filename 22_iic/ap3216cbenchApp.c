@@ -0,0 +1,196 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "sys/ioctl.h"
+#include "ap3216cioctl.h"
+
+/*
+ * AP3216C读取速度测试, 分别测试逐个读取、突发读取和读取后台采样的缓存:
+ *     ./ap3216cbenchApp /dev/ap3216c [次数]
+ * 通过/sys/module/ap3216c/parameters/burst_read切换读取方式,
+ * 前两项测试时关闭后台采样, 使每次read()都访问芯片。
+ *
+ * 没有开发板时可以配合ap3216cemu模拟器使用, 此时还会检查每个采样是否正确:
+ *     insmod ap3216c.ko; insmod ap3216cemu.ko [conv_us=N] [invalid_every=N]
+ * 模拟器的ALS为转换序号n, IR和PS由n推出, IR_OF置位时IR和PS应为0。
+ * 逐个读取时可能读到两次转换各一半的数据, 这也是突发读取要解决的问题
+ */
+
+#define BURST_PARAM     "/sys/module/ap3216c/parameters/burst_read"
+#define EMU_PARAM       "/sys/module/ap3216cemu/parameters/invalid_every"
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int set_burst(int on)
+{
+	int fd, ret;
+
+	fd = open(BURST_PARAM, O_WRONLY);
+	if(fd < 0)
+		return -1;
+	ret = write(fd, on ? "1" : "0", 1);
+	close(fd);
+	return ret == 1 ? 0 : -1;
+}
+
+/*读取模拟器的invalid_every参数, 没有加载模拟器时返回-1*/
+static int emu_invalid_every(void)
+{
+	int fd, ret;
+	char buf[16];
+
+	fd = open(EMU_PARAM, O_RDONLY);
+	if(fd < 0)
+		return -1;
+	ret = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+	return atoi(buf);
+}
+
+/*按模拟器的规律检查一个采样, 返回0表示正确*/
+static int check_sample(const struct ap3216c_sample *s, int invalid_every)
+{
+	unsigned int n = s->als;
+	unsigned int ir = n & 0x3FF;
+
+	if(invalid_every > 0 && n % invalid_every == 0)
+		return s->ir != 0 || s->ps != 0;
+	return s->ir != ir || s->ps != 0x3FF - ir;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * 连续读取count次, 打印吞吐量和单次read()延迟,
+ * invalid_every>=0时检查数据, 返回每秒读取次数
+ */
+static long long bench(int fd, int count, long long *lat, int invalid_every)
+{
+	int i;
+	int invalid = 0, errors = 0;
+	struct ap3216c_sample s;
+	long long start, t, ns, sum = 0;
+
+	start = now_ns();
+	for(i = 0; i < count; i++)
+	{
+		t = now_ns();
+		if(read(fd, &s, sizeof(s)) != sizeof(s))
+			memset(&s, 0, sizeof(s));
+		lat[i] = now_ns() - t;
+		sum += lat[i];
+
+		if(invalid_every >= 0)
+		{
+			if(invalid_every > 0 && s.als % invalid_every == 0)
+				invalid++;
+			if(check_sample(&s, invalid_every))
+			{
+				if(errors < 5)
+					printf("  bad sample: ir = %u, als = %u, ps = %u\r\n", s.ir, s.als, s.ps);
+				errors++;
+			}
+		}
+	}
+	ns = now_ns() - start;
+
+	qsort(lat, count, sizeof(lat[0]), cmp_ll);
+	printf("  %d reads in %lld us, %lld reads/s\r\n", count, ns / 1000, count * 1000000000LL / ns);
+	printf("  latency us: min %lld, avg %lld, p50 %lld, p99 %lld, max %lld\r\n",
+	       lat[0] / 1000, sum / count / 1000, lat[count / 2] / 1000,
+	       lat[count * 99 / 100] / 1000, lat[count - 1] / 1000);
+	if(invalid_every >= 0)
+		printf("  checked: %d invalid IR/PS, %d errors\r\n", invalid, errors);
+	return count * 1000000000LL / ns;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd;
+    int count = 1000;
+    int period = 0;
+    int mode = AP3216C_MODE_ALL;
+    int invalid_every;
+    long long single, burst;
+    long long *lat;
+
+    if(argc != 2 && argc != 3)
+    {
+        printf("Error param!\r\n");
+        return -1;
+    }
+    if(argc == 3)
+        count = atoi(argv[2]);
+    if(count <= 0)
+        count = 1000;
+
+    lat = malloc(count * sizeof(lat[0]));
+    if(!lat)
+        return -1;
+
+    fd = open(argv[1], O_RDWR);
+    if(fd < 0)
+    {
+        printf("file %s open failed!\r\n", argv[1]);
+        free(lat);
+        return -1;
+    }
+
+    /*检查数据需要ALS, 使用全部通道*/
+    if(ioctl(fd, AP3216C_SET_PERIOD, &period) < 0 ||
+       ioctl(fd, AP3216C_SET_MODE, &mode) < 0)
+    {
+        printf("configure failed!\r\n");
+        close(fd);
+        free(lat);
+        return -1;
+    }
+
+    invalid_every = emu_invalid_every();
+    if(invalid_every >= 0)
+        printf("ap3216cemu loaded, checking samples\r\n");
+
+    if(set_burst(0) < 0)
+    {
+        printf("can't write %s!\r\n", BURST_PARAM);
+        close(fd);
+        free(lat);
+        return -1;
+    }
+    printf("register by register:\r\n");
+    single = bench(fd, count, lat, invalid_every);
+
+    set_burst(1);
+    printf("burst:\r\n");
+    burst = bench(fd, count, lat, invalid_every);
+
+    printf("speedup = %lld.%02lldx\r\n", burst / single, burst * 100 / single % 100);
+
+    period = AP3216C_DEFAULT_PERIOD_MS;
+    ioctl(fd, AP3216C_SET_PERIOD, &period);
+    printf("cached:\r\n");
+    bench(fd, count, lat, invalid_every);
+
+    close(fd);
+    free(lat);
+    return 0;
+}
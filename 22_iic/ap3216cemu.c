@@ -0,0 +1,413 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/hrtimer.h>
+#include <linux/irq.h>
+#include <linux/platform_device.h>
+#include <linux/i2c.h>
+
+#include "ap3216creg.h"
+#include "ap3216cioctl.h"
+
+/*
+ * AP3216C寄存器模型, 用来在没有开发板时测试ap3216c驱动:
+ * 注册一个软件I2C适配器, 在上面挂一个名字为"alk,ap3216c"、地址为0x1E的i2c_client,
+ * 未修改的ap3216c驱动即可在x86或QEMU内核上probe。
+ *
+ * 模拟的内容:
+ *   SYSTEMCONG(工作模式、复位、掉电)、数据寄存器0x0A~0x0F, 其余寄存器只做读写存储,
+ *   读写地址自动递增, 一个i2c_msg内的访问是原子的, 不会读到两次转换各一半的数据
+ *   int_pin=1时还模拟INT引脚: 分配一个软件中断号交给i2c_client, 按转换周期推进转换,
+ *   测量值超出ALS/PS阈值时置位INTSTATUS(区间方式, 写1清除), 置位期间每次转换触发一次中断
+ *
+ * 合成数据: 每完成一次转换n加1(16位回绕), ALS = n, IR = n & 0x3FF, PS = 0x3FF - IR,
+ * n为invalid_every的倍数时置位IR_OF(IR低字节bit7), 此时IR和PS寄存器填入无效数据,
+ * PS高于511时置位两个PS寄存器的OBJ位(bit7), 用来检查驱动是否屏蔽了标志位。
+ * 应用程序由ALS推出n, 即可检查IR和PS是否正确
+ */
+
+#define EMU_NAME            "ap3216cemu"
+#define EMU_ADDR            0x1E        /* AP3216C的I2C地址 */
+#define EMU_NREGS           0x30
+#define EMU_IR_OF           0x80        /* IR低字节: IR和PS数据无效 */
+#define EMU_PS_OBJ          0x80        /* PS两个字节: 检测到物体 */
+
+/*0表示按工作模式使用芯片的转换时间, 与真实芯片相同*/
+static unsigned int conv_us;
+module_param(conv_us, uint, 0444);
+MODULE_PARM_DESC(conv_us, "force the conversion time in us, 0 follows SYSTEMCONG");
+
+/*每多少次转换有一次IR/PS无效, 取2的幂时在n回绕处也保持规律*/
+static unsigned int invalid_every = 8;
+module_param(invalid_every, uint, 0444);
+MODULE_PARM_DESC(invalid_every, "set IR_OF on every Nth conversion, 0 never");
+
+/*模拟INT引脚, 用来测试驱动的阈值中断*/
+static bool int_pin;
+module_param(int_pin, bool, 0444);
+MODULE_PARM_DESC(int_pin, "emulate the INT pin with a software irq");
+
+/*模拟器状态*/
+struct ap3216cemu_dev {
+    struct i2c_adapter adap;    /* 软件I2C适配器 */
+    struct i2c_client *client;  /* 挂在适配器上的AP3216C */
+
+    spinlock_t lock;            /* 保护以下寄存器状态 */
+    u8 regs[EMU_NREGS];         /* 寄存器 */
+    u8 ptr;                     /* 寄存器地址指针 */
+    u16 n;                      /* 已完成的转换次数 */
+    u64 last_ns;                /* 上一次转换完成的时刻 */
+    u64 xfers;                  /* 处理的i2c_msg个数 */
+
+    int irq;                    /* INT引脚的软件中断号, 0表示不模拟 */
+    struct hrtimer timer;       /* 按转换周期推进转换并触发中断 */
+};
+
+/*
+* @description : 当前工作模式一次转换的时间
+*/
+static u64 ap3216cemu_conv_ns(struct ap3216cemu_dev *emu)
+{
+    if(conv_us)
+        return (u64)conv_us * NSEC_PER_USEC;
+
+    switch(emu->regs[AP3216C_SYSTEMCONG] & 0x03){
+        case AP3216C_MODE_ALS:
+            return 100 * NSEC_PER_MSEC;
+        case AP3216C_MODE_PS_IR:
+            return 12500 * NSEC_PER_USEC;
+        default:
+            return 112500 * NSEC_PER_USEC;
+    }
+}
+
+/*
+* @description : 按n生成数据寄存器, 调用者需持有emu->lock
+*/
+static void ap3216cemu_fill(struct ap3216cemu_dev *emu)
+{
+    u8 *out = &emu->regs[AP3216C_IRDATALOW];
+    u16 ir = emu->n & 0x3FF;
+    u16 ps = 0x3FF - ir;
+
+    out[2] = emu->n & 0xFF;
+    out[3] = emu->n >> 8;
+
+    if(invalid_every && emu->n % invalid_every == 0){
+        /*无效时寄存器中是上一次的残留, 这里填入容易识别的错误值*/
+        out[0] = EMU_IR_OF | 0x03;
+        out[1] = 0xFF;
+        out[4] = 0x0F;
+        out[5] = 0x3F;
+        return;
+    }
+
+    out[0] = ir & 0x03;
+    out[1] = ir >> 2;
+    out[4] = ps & 0x0F;
+    out[5] = (ps >> 4) & 0x3F;
+    if(ps > 511){
+        out[4] |= EMU_PS_OBJ;
+        out[5] |= EMU_PS_OBJ;
+    }
+}
+
+/*
+* @description : 用最近一次转换的结果判断是否超出阈值, 调用者需持有emu->lock
+*/
+static void ap3216cemu_check_int(struct ap3216cemu_dev *emu)
+{
+    const u8 *r = emu->regs;
+    u8 mode = r[AP3216C_SYSTEMCONG] & 0x03;
+    u16 als = r[AP3216C_ALSDATALOW] | (r[AP3216C_ALSDATAHIGH] << 8);
+    u16 ps = (r[AP3216C_PSDATALOW] & 0x0F) | ((r[AP3216C_PSDATAHIGH] & 0x3F) << 4);
+
+    if(mode & AP3216C_MODE_ALS){
+        if(als < (r[AP3216C_ALSTHRLOWL] | (r[AP3216C_ALSTHRLOWH] << 8)) ||
+           als > (r[AP3216C_ALSTHRHIGHL] | (r[AP3216C_ALSTHRHIGHH] << 8)))
+            emu->regs[AP3216C_INTSTATUS] |= AP3216C_INT_ALS;
+    }
+    /*IR_OF置位时PS无效, 不判断*/
+    if((mode & AP3216C_MODE_PS_IR) && !(r[AP3216C_IRDATALOW] & EMU_IR_OF)){
+        if(ps < ((r[AP3216C_PSTHRLOWL] & 0x03) | (r[AP3216C_PSTHRLOWH] << 2)) ||
+           ps > ((r[AP3216C_PSTHRHIGHL] & 0x03) | (r[AP3216C_PSTHRHIGHH] << 2)))
+            emu->regs[AP3216C_INTSTATUS] |= AP3216C_INT_PS;
+    }
+}
+
+/*
+* @description : 按经过的时间推进转换, 掉电时数据保持不变, 调用者需持有emu->lock
+*/
+static void ap3216cemu_update(struct ap3216cemu_dev *emu)
+{
+    u64 now = ktime_get_ns();
+    u64 conv = ap3216cemu_conv_ns(emu);
+    u64 done;
+
+    if(!(emu->regs[AP3216C_SYSTEMCONG] & 0x03)){
+        emu->last_ns = now;
+        return;
+    }
+
+    done = div64_u64(now - emu->last_ns, conv);
+    if(!done)
+        return;
+    emu->n += done;
+    emu->last_ns += done * conv;
+    ap3216cemu_fill(emu);
+    ap3216cemu_check_int(emu);
+}
+
+static void ap3216cemu_reset(struct ap3216cemu_dev *emu)
+{
+    memset(emu->regs, 0, sizeof(emu->regs));
+    /*复位后高阈值为满量程, 不产生中断*/
+    emu->regs[AP3216C_ALSTHRHIGHL] = 0xFF;
+    emu->regs[AP3216C_ALSTHRHIGHH] = 0xFF;
+    emu->regs[AP3216C_PSTHRHIGHL] = 0x03;
+    emu->regs[AP3216C_PSTHRHIGHH] = 0xFF;
+    emu->n = 0;
+    emu->last_ns = ktime_get_ns();
+    ap3216cemu_fill(emu);
+}
+
+/*
+* @description : 写一个寄存器, 调用者需持有emu->lock
+*/
+static void ap3216cemu_write_reg(struct ap3216cemu_dev *emu, u8 reg, u8 val)
+{
+    if(reg >= EMU_NREGS)
+        return;
+    if(reg >= AP3216C_IRDATALOW && reg <= AP3216C_PSDATAHIGH)
+        return;                         /* 数据寄存器只读 */
+
+    if(reg == AP3216C_SYSTEMCONG){
+        if(val & 0x04){                 /* 软件复位, 复位后SYSTEMCONG为0 */
+            ap3216cemu_reset(emu);
+            return;
+        }
+        /*切换模式时重新开始一次转换*/
+        if((val & 0x03) != (emu->regs[reg] & 0x03))
+            emu->last_ns = ktime_get_ns();
+        val &= 0x03;
+    }
+    if(reg == AP3216C_INTSTATUS){       /* 写1清除 */
+        emu->regs[reg] &= ~val;
+        return;
+    }
+    emu->regs[reg] = val;
+}
+
+static u8 ap3216cemu_read_reg(struct ap3216cemu_dev *emu, u8 reg)
+{
+    return reg < EMU_NREGS ? emu->regs[reg] : 0;
+}
+
+/*
+* @description : 处理I2C传输, 写消息的第一个字节为寄存器地址, 之后为要写入的数据,
+*                读消息从当前寄存器地址开始读, 地址自动递增
+*/
+static int ap3216cemu_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+    int i, j;
+    unsigned long flags;
+    struct ap3216cemu_dev *emu = i2c_get_adapdata(adap);
+
+    for(i = 0; i < num; i++){
+        if(msgs[i].addr != EMU_ADDR)
+            return i ? i : -ENXIO;      /* 没有应答 */
+    }
+
+    spin_lock_irqsave(&emu->lock, flags);    /* 与hrtimer的回调互斥 */
+    ap3216cemu_update(emu);
+    for(i = 0; i < num; i++){
+        struct i2c_msg *m = &msgs[i];
+
+        if(m->flags & I2C_M_RD){
+            for(j = 0; j < m->len; j++)
+                m->buf[j] = ap3216cemu_read_reg(emu, emu->ptr++);
+        }else if(m->len){
+            emu->ptr = m->buf[0];
+            for(j = 1; j < m->len; j++)
+                ap3216cemu_write_reg(emu, emu->ptr++, m->buf[j]);
+        }
+        emu->xfers++;
+    }
+    spin_unlock_irqrestore(&emu->lock, flags);
+    return num;
+}
+
+static u32 ap3216cemu_func(struct i2c_adapter *adap)
+{
+    return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static const struct i2c_algorithm ap3216cemu_algo = {
+    .master_xfer = ap3216cemu_xfer,
+    .functionality = ap3216cemu_func,
+};
+
+/*
+* @description : 每个转换周期推进一次转换, INTSTATUS置位时触发中断,
+*                中断线程清除INTSTATUS之前一直触发, 相当于低电平有效的INT引脚
+*/
+static enum hrtimer_restart ap3216cemu_timer_func(struct hrtimer *timer)
+{
+    u8 status;
+    u64 conv;
+    struct ap3216cemu_dev *emu = container_of(timer, struct ap3216cemu_dev, timer);
+
+    spin_lock(&emu->lock);
+    ap3216cemu_update(emu);
+    status = emu->regs[AP3216C_INTSTATUS];
+    conv = ap3216cemu_conv_ns(emu);
+    spin_unlock(&emu->lock);
+
+    if(status)
+        generic_handle_irq(emu->irq);
+    hrtimer_forward_now(timer, ns_to_ktime(conv));
+    return HRTIMER_RESTART;
+}
+
+/*
+* @description : 分配INT引脚的软件中断号, 中断控制器的操作都是空操作
+* @return : 中断号, <0 失败
+*/
+static int ap3216cemu_irq_init(struct ap3216cemu_dev *emu)
+{
+    int irq;
+
+    irq = irq_alloc_descs(-1, 1, 1, numa_node_id());   /* 0表示没有中断, 从1开始分配 */
+    if(irq < 0)
+        return irq;
+    irq_set_chip_and_handler(irq, &dummy_irq_chip, handle_level_irq);
+    irq_modify_status(irq, IRQ_NOREQUEST, IRQ_NOPROBE);    /* 允许驱动request_irq */
+
+    hrtimer_init(&emu->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    emu->timer.function = ap3216cemu_timer_func;
+    emu->irq = irq;
+    return irq;
+}
+
+static int ap3216cemu_probe(struct platform_device *pdev)
+{
+    int ret;
+    struct ap3216cemu_dev *emu;
+    struct i2c_board_info info = {
+        I2C_BOARD_INFO("alk,ap3216c", EMU_ADDR),
+    };
+
+    emu = devm_kzalloc(&pdev->dev, sizeof(*emu), GFP_KERNEL);
+    if(!emu)
+        return -ENOMEM;
+
+    spin_lock_init(&emu->lock);
+    ap3216cemu_reset(emu);
+    platform_set_drvdata(pdev, emu);
+
+    emu->adap.owner = THIS_MODULE;
+    emu->adap.algo = &ap3216cemu_algo;
+    emu->adap.dev.parent = &pdev->dev;
+    emu->adap.nr = -1;                  /* 动态分配总线号 */
+    strlcpy(emu->adap.name, EMU_NAME, sizeof(emu->adap.name));
+    i2c_set_adapdata(&emu->adap, emu);
+
+    if(int_pin){
+        ret = ap3216cemu_irq_init(emu);
+        if(ret < 0)
+            return ret;
+        info.irq = ret;
+    }
+
+    ret = i2c_add_adapter(&emu->adap);
+    if(ret < 0)
+        goto fail_adap;
+
+    /*挂上AP3216C, ap3216c驱动已加载时会立即probe*/
+    emu->client = i2c_new_device(&emu->adap, &info);
+    if(!emu->client){
+        ret = -ENODEV;
+        goto fail_client;
+    }
+    if(emu->irq)
+        hrtimer_start(&emu->timer, ns_to_ktime(ap3216cemu_conv_ns(emu)), HRTIMER_MODE_REL);
+
+    printk("%s: i2c-%d, addr = %#x, irq = %d\r\n", EMU_NAME, emu->adap.nr, EMU_ADDR, emu->irq);
+    return 0;
+
+fail_client:
+    i2c_del_adapter(&emu->adap);
+fail_adap:
+    if(emu->irq)
+        irq_free_desc(emu->irq);
+    return ret;
+}
+
+static int ap3216cemu_remove(struct platform_device *pdev)
+{
+    struct ap3216cemu_dev *emu = platform_get_drvdata(pdev);
+
+    printk("%s: %llu i2c messages, %u conversions\r\n", EMU_NAME, emu->xfers, emu->n);
+
+    /*先注销i2c_client, ap3216c驱动会停止访问并释放中断*/
+    i2c_unregister_device(emu->client);
+    i2c_del_adapter(&emu->adap);
+    if(emu->irq){
+        hrtimer_cancel(&emu->timer);
+        irq_free_desc(emu->irq);
+    }
+    return 0;
+}
+
+static void ap3216cemu_release(struct device *dev)
+{
+}
+
+/*platform设备, 作为软件I2C适配器的父设备*/
+static struct platform_device ap3216cemu_device = {
+    .name = EMU_NAME,
+    .id = -1,
+    .dev = {
+        .release = ap3216cemu_release,
+    },
+};
+
+static struct platform_driver ap3216cemu_driver = {
+    .probe = ap3216cemu_probe,
+    .remove = ap3216cemu_remove,
+    .driver = {
+        .name = EMU_NAME,
+        .owner = THIS_MODULE,
+    },
+};
+
+static int __init ap3216cemu_init(void)
+{
+    int ret;
+
+    ret = platform_driver_register(&ap3216cemu_driver);
+    if(ret < 0)
+        return ret;
+
+    ret = platform_device_register(&ap3216cemu_device);
+    if(ret < 0)
+        platform_driver_unregister(&ap3216cemu_driver);
+    return ret;
+}
+
+static void __exit ap3216cemu_exit(void)
+{
+    platform_device_unregister(&ap3216cemu_device);
+    platform_driver_unregister(&ap3216cemu_driver);
+}
+
+module_init(ap3216cemu_init);
+module_exit(ap3216cemu_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("mankc");
@@ -0,0 +1,142 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "sys/ioctl.h"
+#include "poll.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "ap3216cioctl.h"
+
+/*
+ * AP3216C阈值事件测试, 需要ap3216cemu模拟器:
+ *     insmod ap3216c.ko; insmod ap3216cemu.ko int_pin=1 conv_us=1000 invalid_every=0
+ *     ./ap3216ceventApp /dev/ap3216c [超时秒数]
+ * 模拟器的PS从1023递减到0后回到1023, 阈值设为0~511时每个周期都会
+ * 先离开高于阈值的区域, 再回到高于阈值的区域。测试等PS第一次高于阈值后,
+ * 检查随后依次收到回到阈值之内和再次高于阈值两个事件。
+ * int_pin=1时事件由阈值中断产生, int_pin=0时由后台采样产生, 两种情况都应通过
+ */
+
+#define EMU_PARAM       "/sys/module/ap3216cemu/parameters/invalid_every"
+#define PS_HIGH         511
+
+/*读取模拟器的invalid_every参数, 没有加载模拟器时返回-1*/
+static int emu_invalid_every(void)
+{
+	int fd, ret;
+	char buf[16];
+
+	fd = open(EMU_PARAM, O_RDONLY);
+	if(fd < 0)
+		return -1;
+	ret = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+	return atoi(buf);
+}
+
+/*等待下一个PS事件, 返回PS的位置, 超时或出错返回-2*/
+static int next_ps_event(int fd, int timeout_ms)
+{
+	struct ap3216c_event event;
+	struct pollfd fds;
+
+	fds.fd = fd;
+	fds.events = POLLIN;
+	while(1)
+	{
+		if(poll(&fds, 1, timeout_ms) <= 0)
+			return -2;
+		if(read(fd, &event, sizeof(event)) != sizeof(event))
+			return -2;
+		if(!(event.source & AP3216C_EVT_PS))
+			continue;
+		printf("  ps = %u, zone = %d\r\n", event.ps, event.ps_zone);
+		return event.ps_zone;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+    int fd, i;
+    int ret = -1;
+    int timeout = 30;
+    int mode = AP3216C_MODE_PS_IR;
+    int format = AP3216C_FMT_EVENT;
+    int dropped = 0;
+    struct ap3216c_thresh thresh;
+    static const int expect[] = { AP3216C_ZONE_IN, AP3216C_ZONE_HIGH };
+
+    if(argc != 2 && argc != 3)
+    {
+        printf("Error param!\r\n");
+        return -1;
+    }
+    if(argc == 3)
+        timeout = atoi(argv[2]);
+    if(timeout <= 0)
+        timeout = 30;
+
+    /*模拟器的无效数据会被驱动当作PS = 0, 产生多余的事件*/
+    if(emu_invalid_every() != 0)
+    {
+        printf("load ap3216cemu with invalid_every=0 first!\r\n");
+        return -1;
+    }
+
+    fd = open(argv[1], O_RDWR);
+    if(fd < 0)
+    {
+        printf("file %s open failed!\r\n", argv[1]);
+        return -1;
+    }
+
+    /*只开启PS, ALS阈值为整个量程, 不产生事件*/
+    thresh.als_low = 0;
+    thresh.als_high = 0xFFFF;
+    thresh.ps_low = 0;
+    thresh.ps_high = PS_HIGH;
+    if(ioctl(fd, AP3216C_SET_MODE, &mode) < 0 ||
+       ioctl(fd, AP3216C_SET_THRESH, &thresh) < 0 ||
+       ioctl(fd, AP3216C_SET_FORMAT, &format) < 0)
+    {
+        printf("configure failed!\r\n");
+        goto out;
+    }
+
+    printf("waiting for ps > %d:\r\n", PS_HIGH);
+    while((i = next_ps_event(fd, timeout * 1000)) != AP3216C_ZONE_HIGH)
+    {
+        if(i == -2)
+        {
+            printf("FAIL: no event in %d s\r\n", timeout);
+            goto out;
+        }
+    }
+
+    printf("high -> in -> high:\r\n");
+    for(i = 0; i < 2; i++)
+    {
+        int zone = next_ps_event(fd, timeout * 1000);
+
+        if(zone != expect[i])
+        {
+            if(zone == -2)
+                printf("FAIL: event %d lost\r\n", i + 1);
+            else
+                printf("FAIL: event %d zone = %d, expected %d\r\n", i + 1, zone, expect[i]);
+            goto out;
+        }
+    }
+
+    ioctl(fd, AP3216C_GET_DROPPED, &dropped);
+    printf("PASS, %d dropped\r\n", dropped);
+    ret = 0;
+out:
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,79 @@
+#ifndef _AP3216CIOCTL_H
+#define _AP3216CIOCTL_H
+
+/*
+ * AP3216C驱动与应用程序共用的数据格式和ioctl命令
+ */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * read()的缓冲区不小于struct ap3216c_sample时返回该结构体和它的长度,
+ * 否则按旧格式返回unsigned short data[3] = {ir, als, ps}, read返回0,
+ * 当前工作模式下没有开启的通道为0
+ */
+struct ap3216c_sample {
+    __s64 timestamp;    /* 采样时刻的ktime(CLOCK_MONOTONIC, 单位ns) */
+    __u64 age_ns;       /* read()时距采样时刻的时间 */
+    __u32 seq;          /* 采样序号, 每次采样加1 */
+    __u16 ir;
+    __u16 als;
+    __u16 ps;
+    __u16 reserved;
+};
+
+/* 默认采样周期, AP3216C在ALS+PS+IR模式下约112.5ms完成一次转换 */
+#define AP3216C_DEFAULT_PERIOD_MS   100
+
+/* 工作模式, 即SYSTEMCONG的值, 只转换和读取开启的通道 */
+#define AP3216C_MODE_ALS        0x01    /* 只有ALS, 一次转换约100ms */
+#define AP3216C_MODE_PS_IR      0x02    /* 只有PS+IR, 一次转换约12.5ms */
+#define AP3216C_MODE_ALL        0x03    /* ALS和PS+IR, 一次转换约112.5ms */
+
+/* read()返回的数据格式 */
+#define AP3216C_FMT_SAMPLE      0       /* 最近一次采样, 见上面的说明 */
+#define AP3216C_FMT_EVENT       1       /* 阈值事件: struct ap3216c_event, 没有事件时阻塞 */
+
+/* 阈值, 测量值低于low或高于high时产生事件 */
+struct ap3216c_thresh {
+    __u16 als_low;
+    __u16 als_high;
+    __u16 ps_low;       /* PS为10位, 0~1023 */
+    __u16 ps_high;
+};
+
+/* 测量值相对阈值的位置 */
+#define AP3216C_ZONE_LOW        -1      /* 低于低阈值 */
+#define AP3216C_ZONE_IN         0       /* 在两个阈值之间 */
+#define AP3216C_ZONE_HIGH       1       /* 高于高阈值 */
+
+/* 事件来源 */
+#define AP3216C_EVT_ALS         0x01
+#define AP3216C_EVT_PS          0x02
+
+/*
+ * 阈值事件, 只在测量值进入或离开阈值区间时产生
+ */
+struct ap3216c_event {
+    __s64 timestamp;    /* 事件时刻的ktime(CLOCK_MONOTONIC, 单位ns) */
+    __u16 ir;
+    __u16 als;
+    __u16 ps;
+    __u8  source;       /* AP3216C_EVT_xxx, 位置发生变化的通道 */
+    __s8  als_zone;     /* AP3216C_ZONE_xxx */
+    __s8  ps_zone;
+    __u8  reserved[7];
+};
+
+/* ioctl命令 */
+#define AP3216C_SET_PERIOD      _IOW(0xED, 1, int)  /* 采样周期ms, 0表示每次read()都直接读取芯片 */
+#define AP3216C_GET_PERIOD      _IOR(0xED, 2, int)
+#define AP3216C_SET_THRESH      _IOW(0xED, 3, struct ap3216c_thresh)
+#define AP3216C_GET_THRESH      _IOR(0xED, 4, struct ap3216c_thresh)
+#define AP3216C_SET_FORMAT      _IOW(0xED, 5, int)  /* 本文件read()的格式, AP3216C_FMT_xxx */
+#define AP3216C_GET_FORMAT      _IOR(0xED, 6, int)
+#define AP3216C_GET_DROPPED     _IOR(0xED, 7, int)  /* 本文件读得太慢被覆盖的事件个数 */
+#define AP3216C_SET_MODE        _IOW(0xED, 8, int)  /* 工作模式, AP3216C_MODE_xxx, 所有文件共用 */
+#define AP3216C_GET_MODE        _IOR(0xED, 9, int)
+
+#endif // !_AP3216CIOCTL_H
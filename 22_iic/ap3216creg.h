@@ -12,4 +12,30 @@
 #define AP3216C_PSDATALOW       0X0E
 #define AP3216C_PSDATAHIGH      0X0F
 
+/* ALS配置和阈值 */
+#define AP3216C_ALSCONFIG       0X10    /* bit5:4 增益, bit3:0 中断持续次数 */
+#define AP3216C_ALSCALIB        0X19
+#define AP3216C_ALSTHRLOWL      0X1A    /* ALS低阈值, 16位 */
+#define AP3216C_ALSTHRLOWH      0X1B
+#define AP3216C_ALSTHRHIGHL     0X1C    /* ALS高阈值, 16位 */
+#define AP3216C_ALSTHRHIGHH     0X1D
+
+/* PS配置和阈值 */
+#define AP3216C_PSCONFIG        0X20    /* bit1:0 中断持续次数 */
+#define AP3216C_PSLEDDRIVER     0X21
+#define AP3216C_PSINTFORM       0X22    /* 0: 区间方式, 1: 迟滞方式 */
+#define AP3216C_PSMEANTIME      0X23
+#define AP3216C_PSLEDWAIT       0X24
+#define AP3216C_PSCALIBL        0X28
+#define AP3216C_PSCALIBH        0X29
+#define AP3216C_PSTHRLOWL       0X2A    /* PS低阈值, 10位, 低字节bit1:0为阈值bit1:0 */
+#define AP3216C_PSTHRLOWH       0X2B    /* 阈值bit9:2 */
+#define AP3216C_PSTHRHIGHL      0X2C    /* PS高阈值 */
+#define AP3216C_PSTHRHIGHH      0X2D
+
+/* 中断状态和清除方式 */
+#define AP3216C_INT_ALS         0X01    /* INTSTATUS: ALS中断 */
+#define AP3216C_INT_PS          0X02    /* INTSTATUS: PS中断 */
+#define AP3216C_INT_CLR_SW      0X01    /* INTCLEAR: 向INTSTATUS写1清除中断 */
+
 #endif // !__AP3216C_H
\ No newline at end of file
@@ -6,7 +6,6 @@
 #include <linux/module.h>
 #include <linux/errno.h>
 #include <linux/gpio.h>
-#include <asm/mach/map.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include <linux/cdev.h>
@@ -17,17 +16,89 @@
 #include <linux/input.h>
 #include <linux/i2c.h>
 #include <linux/spi/spi.h>
+#include <linux/ktime.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/interrupt.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/regmap.h>
 
 #include "icm20608reg.h"
+#include "icm20608ioctl.h"
 
-#define icm20608_CNT       1
+#define CREATE_TRACE_POINTS
+#include "icm20608_trace.h"
+
+#define icm20608_CNT       8           /*最多支持的ICM20608个数*/
 #define icm20608_NAME      "icm20608"
 
+#define ICM20608_TEMP_SENS_X10  3268    /* 温度灵敏度326.8LSB/°C */
+
+#define ICM20608_CALIB_SAMPLES      256     /* 校准默认平均次数 */
+#define ICM20608_CALIB_MAX_SAMPLES  4096    /* 校准最大平均次数 */
+#define ICM20608_RING_LEN           256     /* 共享环形缓冲区的采样个数, 必须为2的幂 */
+
+#define ICM20608_INT_ANYRD_2CLEAR   0x10    /* INT_PIN_CFG: 任意读操作清除中断 */
+#define ICM20608_DATA_RDY_INT_EN    0x01    /* INT_ENABLE: 数据就绪中断 */
+#define ICM20608_FIFO_OFLOW_INT     0x10    /* INT_STATUS: FIFO溢出 */
+#define ICM20608_FIFO_EN_ALL        0xF8    /* FIFO_EN: 温度、陀螺仪XYZ、加速度计 */
+#define ICM20608_USER_FIFO_EN       0x40    /* USER_CTRL: 打开FIFO */
+#define ICM20608_USER_FIFO_RST      0x04    /* USER_CTRL: 复位FIFO */
+
+#define ICM20608_RECORD_LEN         14      /* 数据寄存器和FIFO中一个采样的字节数 */
+#define ICM20608_FIFO_MAX_RECORDS   36      /* 512字节FIFO最多能存放的采样个数 */
+#define ICM20608_CHANNELS           7       /* 陀螺仪XYZ、加速度计XYZ、温度 */
+
+#define ICM20608_HIST_BUCKETS       32      /* 延时直方图桶数, 第k个桶为[2^k, 2^(k+1))ns */
+
+/*超过这个时间的spi_sync记为一次阻塞, 用来观察共享ECSPI总线的争用*/
+static unsigned int stall_us = 500;
+module_param(stall_us, uint, 0644);
+MODULE_PARM_DESC(stall_us, "count an SPI transfer as stalled above this many microseconds");
+
+/*复位和启动需要约100ms, 异步probe时放到工作队列中完成, 不阻塞启动过程*/
+static bool async_probe;
+module_param(async_probe, bool, 0444);
+MODULE_PARM_DESC(async_probe, "initialize the sensor from a work item instead of probe");
+
+/*一类操作的统计*/
+struct icm20608_xfer_stats {
+    u64 count;                  /* 次数 */
+    u64 bytes;                  /* 数据字节数, 不含寄存器地址 */
+    u64 errors;                 /* 失败次数 */
+    u64 stalls;                 /* 超过stall_us的次数 */
+    u64 total_ns;               /* 总耗时 */
+    u64 max_ns;                 /* 最大耗时 */
+    u32 hist[ICM20608_HIST_BUCKETS];    /* log2延时直方图 */
+};
+
+/*寄存器访问和采集的统计, 通过debugfs导出*/
+struct icm20608_stats {
+    spinlock_t lock;
+    struct icm20608_xfer_stats read;    /* icm20608_read_regs */
+    struct icm20608_xfer_stats write;   /* icm20608_write_regs */
+    struct icm20608_xfer_stats sample;  /* 从数据就绪到采样读出 */
+};
+
+/*抽取滤波器状态*/
+struct icm20608_decim_state {
+    s16 hist[ICM20608_CHANNELS][ICM20608_DECIM_MAX_TAPS];  /* 各通道最近的输入 */
+    unsigned int pos;           /* 下一个输入的写入位置 */
+    unsigned int phase;         /* 自上一个输出以来的输入个数 */
+};
+
 /*icm20608设备结构体*/
 struct icm20608_dev{
     dev_t   devid;              /*设备号*/
-    struct cdev cdev;           /*cdev*/
-    struct class *class;        /*类*/
+    struct cdev *cdev;          /*cdev, 单独分配, 最后一个打开的文件关闭后才释放*/
+    struct kref ref;            /*probe和每个打开的文件各持有一个引用*/
+    bool removed;               /*已经remove, 不能再访问芯片, 受lock保护*/
     struct device *device;      /*设备*/
     int major;                  /*主设备号*/
     int minor;                  /*次设备号*/
@@ -35,167 +106,1169 @@ struct icm20608_dev{
     struct device_node *nd;     /*设备节点*/
 
     int cs_gpio;                /* 片选所使用的 GPIO 编号*/
-    signed int gyro_x_adc;      /* 陀螺仪 X 轴原始值 */
-    signed int gyro_y_adc;      /* 陀螺仪 Y 轴原始值 */
-    signed int gyro_z_adc;      /* 陀螺仪 Z 轴原始值 */
-    signed int accel_x_adc;     /* 加速度计 X 轴原始值 */
-    signed int accel_y_adc;     /* 加速度计 Y 轴原始值 */
-    signed int accel_z_adc;     /* 加速度计 Z 轴原始值 */
-    signed int temp_adc;        /* 温度原始值 */
+    struct regmap *regmap;      /* 寄存器访问, 缓存配置寄存器 */
+    struct mutex lock;          /* 保护SPI访问、配置和采样数据 */
+    struct icm20608_config cfg;     /* 当前采样配置 */
+    struct icm20608_sample sample;  /* 最近一次的采样数据 */
+    struct icm20608_offset factory; /* 出厂偏移, 上电复位后读取 */
+
+    int irq;                    /* 数据就绪中断号, <=0表示没有中断, 由轮询线程采集 */
+    s64 irq_ts;                 /* 最近一次数据就绪中断的时刻 */
+    struct task_struct *poll_task;  /* 没有中断时的轮询采集线程 */
+    wait_queue_head_t poll_wait;    /* 轮询线程等待有读者 */
+    int users;                  /* 打开设备的文件个数, 受lock保护 */
+
+    /*所有读者共享一个采集流, 每个文件有自己的读位置*/
+    spinlock_t ring_lock;       /* 保护ring和head */
+    unsigned int head;          /* 已写入ring的采样总数 */
+    struct icm20608_sample ring[ICM20608_RING_LEN];
+    wait_queue_head_t r_wait;   /* 等待新采样的读者 */
+
+    /*抽取*/
+    struct icm20608_decim decim;        /* 抽取倍数和FIR系数, ntaps为0时不滤波 */
+    struct icm20608_decim_state dstate; /* 抽取滤波器的历史输入和相位 */
+    bool fifo_mode;             /* 使用芯片FIFO成批读取 */
+    unsigned int irq_count;     /* FIFO模式下距上次唤醒中断线程的中断次数 */
+    /*FIFO突发读缓冲区, SPI控制器可能用DMA读入, 单独占用cache行*/
+    u8 fifo_buf[ICM20608_FIFO_MAX_RECORDS * ICM20608_RECORD_LEN] ____cacheline_aligned;
+
+    /*调试统计*/
+    struct icm20608_stats stats;    /* SPI传输和采样延迟统计 */
+    struct dentry *debugfs;         /* /sys/kernel/debug/icm20608/<spi设备名> */
+
+    /*异步probe*/
+    struct work_struct init_work;   /* 在工作队列中完成芯片初始化和设备注册 */
+    bool ready;                     /* 初始化成功, 工作队列中写入, 用acquire/release读写 */
 
 }; 
 
-struct icm20608_dev icm20608dev;
+/*每个打开的文件的私有数据*/
+struct icm20608_file{
+    struct icm20608_dev *dev;   /*设备*/
+    int format;                 /*read()返回的数据格式*/
+    unsigned int tail;          /*下一个要读的采样序号, 受ring_lock保护*/
+    unsigned int dropped;       /*读得太慢被覆盖的采样个数*/
+};
+
+static dev_t icm20608_devt;                 /*设备号区域起始*/
+static struct class *icm20608_class;        /*类*/
+static DEFINE_IDR(icm20608_idr);            /*次设备号分配, 次设备号到设备的映射*/
+static DEFINE_MUTEX(icm20608_idr_lock);     /*保护icm20608_idr, 串行化open和remove*/
+static struct dentry *icm20608_debugfs_root;    /*debugfs根目录icm20608*/
 
+/*
+* @description : 记录一次操作的耗时和结果
+* @param - dev : icm20608设备
+* @param - st : 要更新的统计项
+* @param - ns : 耗时
+* @param - bytes : 数据字节数
+* @param - ret : 操作的返回值
+*/
+static void icm20608_stats_add(struct icm20608_dev *dev, struct icm20608_xfer_stats *st,
+                               u64 ns, int bytes, int ret)
+{
+    unsigned int bucket = ns ? min_t(unsigned int, ilog2(ns), ICM20608_HIST_BUCKETS - 1) : 0;
+
+    spin_lock(&dev->stats.lock);
+    st->count++;
+    if(ret < 0)
+        st->errors++;
+    else
+        st->bytes += bytes;
+    if(ns > (u64)READ_ONCE(stall_us) * NSEC_PER_USEC)
+        st->stalls++;
+    st->total_ns += ns;
+    if(ns > st->max_ns)
+        st->max_ns = ns;
+    st->hist[bucket]++;
+    spin_unlock(&dev->stats.lock);
+}
+
+/*
+* @description : 读取ICM20608连续多个寄存器, 地址和数据在同一个spi_message中发送,
+*                保证整个过程片选一直有效(使用控制器片选时也是如此)
+* @param - dev : icm20608设备
+* @param - reg : 要读取的首寄存器地址
+* @param - buf : 读取到的数据
+* @param - len : 要读取的数据长度
+* @return : 0 成功，<0 失败
+*/
 static int icm20608_read_regs(struct icm20608_dev *dev, u8 reg, void *buf, int len)
 {
     int ret;
-    u8 txdata[len];
+    u64 start, ns;
+    u8 txdata[1];                   /*只发送寄存器地址, FIFO突发读取时len可达504*/
     struct spi_message msg;
-    struct spi_transfer *t;
+    struct spi_transfer t[2];       /*只在spi_sync期间使用, 放在栈上, 不必每次kzalloc*/
     struct spi_device *spi = (struct spi_device *)dev->private_data;
 
+    memset(t, 0, sizeof(t));
+
     /*片选拉低，选中ICM20608*/
-    gpio_set_value(dev->cs_gpio, 0);
-    t = kzalloc(sizeof(struct spi_transfer), GFP_KERNEL);
+    if(gpio_is_valid(dev->cs_gpio))
+        gpio_set_value(dev->cs_gpio, 0);
 
     /*发送要读取的寄存器地址*/
     txdata[0] = reg|0x80;           /*读数据的时候寄存器地址的bit7位要置1*/
-    t->tx_buf = txdata;             /*要发送的数据*/
-    t->len = 1;
-    spi_message_init(&msg);         /*初始化msg*/
-    spi_message_add_tail(t, &msg);  /*将spi_transfer添加到spi_message*/
-    ret = spi_sync(spi, &msg);           /*同步发送*/
+    t[0].tx_buf = txdata;           /*要发送的数据*/
+    t[0].len = 1;
 
     /*读取数据*/
-    txdata[0] = 0xff;               /*随便一个值，此数据无意义*/
-    t->rx_buf = buf;                /*读取到的数据*/
-    t->len = len;                   /*要读取的数据长度*/
+    t[1].rx_buf = buf;              /*读取到的数据*/
+    t[1].len = len;                 /*要读取的数据长度*/
+
     spi_message_init(&msg);         /*初始化msg*/
-    spi_message_add_tail(t, &msg);  /*将spi_transfer添加到spi_message*/
+    spi_message_add_tail(&t[0], &msg);  /*将spi_transfer添加到spi_message*/
+    spi_message_add_tail(&t[1], &msg);
+    trace_icm20608_spi_submit(dev_name(&spi->dev), reg, len, false);
+    start = ktime_get_ns();
     ret = spi_sync(spi, &msg);           /*同步发送*/
+    ns = ktime_get_ns() - start;
+    trace_icm20608_spi_complete(dev_name(&spi->dev), reg, len, false, ret, ns);
+    icm20608_stats_add(dev, &dev->stats.read, ns, len, ret);
 
-    kfree(t);                       /*释放内存*/
-    gpio_set_value(dev->cs_gpio, 1);/*片选拉高，释放ICM20608*/
+    if(gpio_is_valid(dev->cs_gpio))
+        gpio_set_value(dev->cs_gpio, 1);/*片选拉高，释放ICM20608*/
 
     return ret;    
 }
 
-static unsigned char icm20608_readone(struct icm20608_dev *dev, u8 reg)
-{
-    u8 data = 0;
-    icm20608_read_regs(dev, reg, &data, 1);
-    return data;
-}
-
 static int icm20608_write_regs(struct icm20608_dev *dev, u8 reg, u8 *buf, u8 len)
 {
     int ret;
-    u8 txdata[len];
+    u64 start, ns;
+    u8 txdata[1];                   /*只发送寄存器地址*/
     struct spi_message msg;
-    struct spi_transfer *t;
+    struct spi_transfer t[2];
     struct spi_device *spi = (struct spi_device *)dev->private_data;
 
+    memset(t, 0, sizeof(t));
+
     /*片选拉低，选中ICM20608*/
-    gpio_set_value(dev->cs_gpio, 0);
-    t = kzalloc(sizeof(struct spi_transfer), GFP_KERNEL);
+    if(gpio_is_valid(dev->cs_gpio))
+        gpio_set_value(dev->cs_gpio, 0);
 
     /*发送要写的寄存器地址*/
     txdata[0] = reg & ~0x80;        /*写数据的时候寄存器地址的bit7位要清零*/
-    t->tx_buf = txdata;             /*要发送的数据*/
-    t->len = 1;
-    spi_message_init(&msg);         /*初始化msg*/
-    spi_message_add_tail(t, &msg);  /*将spi_transfer添加到spi_message*/
-    ret = spi_sync(spi, &msg);           /*同步发送*/
+    t[0].tx_buf = txdata;           /*要发送的数据*/
+    t[0].len = 1;
 
     /*写数据*/
-    t->tx_buf = buf;                /*要写入的数据*/
-    t->len = len;                   /*要写入的数据长度*/
+    t[1].tx_buf = buf;              /*要写入的数据*/
+    t[1].len = len;                 /*要写入的数据长度*/
+
     spi_message_init(&msg);         /*初始化msg*/
-    spi_message_add_tail(t, &msg);  /*将spi_transfer添加到spi_message*/
+    spi_message_add_tail(&t[0], &msg);  /*将spi_transfer添加到spi_message*/
+    spi_message_add_tail(&t[1], &msg);
+    trace_icm20608_spi_submit(dev_name(&spi->dev), reg, len, true);
+    start = ktime_get_ns();
     ret = spi_sync(spi, &msg);           /*同步发送*/
+    ns = ktime_get_ns() - start;
+    trace_icm20608_spi_complete(dev_name(&spi->dev), reg, len, true, ret, ns);
+    icm20608_stats_add(dev, &dev->stats.write, ns, len, ret);
 
-    kfree(t);                       /*释放内存*/
-    gpio_set_value(dev->cs_gpio, 1);/*片选拉高，释放ICM20608*/
+    if(gpio_is_valid(dev->cs_gpio))
+        gpio_set_value(dev->cs_gpio, 1);/*片选拉高，释放ICM20608*/
 
     return ret;   
 }
 
+/*
+ * regmap总线: 通过上面两个函数访问芯片, 保留cs-gpio片选和访问统计,
+ * regmap负责缓存配置寄存器, 数据、状态和FIFO寄存器设为volatile, 每次都访问芯片
+ */
+static int icm20608_regmap_write(void *context, const void *data, size_t count)
+{
+    const u8 *buf = data;
+
+    /*buf[0]为寄存器地址, 之后为数据*/
+    return icm20608_write_regs(context, buf[0], (u8 *)&buf[1], count - 1);
+}
+
+static int icm20608_regmap_read(void *context, const void *reg, size_t reg_size,
+                                void *val, size_t val_size)
+{
+    return icm20608_read_regs(context, *(const u8 *)reg, val, val_size);
+}
+
+static const struct regmap_bus icm20608_regmap_bus = {
+    .write = icm20608_regmap_write,
+    .read = icm20608_regmap_read,
+};
+
+static bool icm20608_volatile_reg(struct device *dev, unsigned int reg)
+{
+    if(reg >= ICM20_INT_STATUS && reg <= ICM20_GYRO_ZOUT_L)
+        return true;                /* 中断状态和数据寄存器 */
+
+    switch(reg){
+        case ICM20_SIGNAL_PATH_RESET:   /* 复位位自动清零 */
+        case ICM20_USER_CTRL:
+        case ICM20_PWR_MGMT_1:
+        case ICM20_FIFO_COUNTH:
+        case ICM20_FIFO_COUNTL:
+        case ICM20_FIFO_R_W:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*读操作有副作用, regmap的debugfs不会读取这些寄存器*/
+static bool icm20608_precious_reg(struct device *dev, unsigned int reg)
+{
+    return reg == ICM20_INT_STATUS || reg == ICM20_FIFO_R_W;
+}
+
+static const struct regmap_config icm20608_regmap_config = {
+    .reg_bits = 8,
+    .val_bits = 8,
+    .max_register = ICM20_ZA_OFFSET_L,
+    .volatile_reg = icm20608_volatile_reg,
+    .precious_reg = icm20608_precious_reg,
+    .cache_type = REGCACHE_RBTREE,
+};
+
+static unsigned char icm20608_readone(struct icm20608_dev *dev, u8 reg)
+{
+    unsigned int data = 0;
+    regmap_read(dev->regmap, reg, &data);
+    return data;
+}
+
 static void icm20608_writeone(struct icm20608_dev *dev, u8 reg, u8 buf)
 {
-    u8 data = buf;
-    icm20608_write_regs(dev, reg, &data, 1);
+    regmap_write(dev->regmap, reg, buf);
+}
+
+/*
+* @description : 解析一个采样, 数据寄存器和FIFO中的顺序相同:
+*                加速度计XYZ、温度、陀螺仪XYZ, 高字节在前
+* @param - data : 14字节原始数据
+* @param - s : 解析结果
+*/
+static void icm20608_parse_record(const u8 *data, struct icm20608_sample *s)
+{
+    s->version  = ICM20608_SAMPLE_VERSION;
+    s->accel[0] = (signed short)((data[0] << 8) | data[1]); 
+	s->accel[1] = (signed short)((data[2] << 8) | data[3]); 
+	s->accel[2] = (signed short)((data[4] << 8) | data[5]); 
+	s->temp     = (signed short)((data[6] << 8) | data[7]); 
+	s->gyro[0]  = (signed short)((data[8] << 8) | data[9]); 
+	s->gyro[1]  = (signed short)((data[10] << 8) | data[11]);
+	s->gyro[2]  = (signed short)((data[12] << 8) | data[13]);
+}
+
+/*
+* @description : 读取一次采样, INT_STATUS(0x3A)与数据寄存器(0x3B~0x48)地址连续,
+*                一次突发读取15个字节
+* @param - dev : icm20608设备
+* @param - timestamp : 数据就绪时刻
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_readdata(struct icm20608_dev *dev, s64 timestamp)
+{
+    int ret;
+    unsigned char data[15];
+    struct icm20608_sample *s = &dev->sample;
+
+    s->timestamp = timestamp;
+    ret = regmap_bulk_read(dev->regmap, ICM20_INT_STATUS, data, 15);
+    icm20608_stats_add(dev, &dev->stats.sample, ktime_get_ns() - timestamp, 15, ret);
+    if(ret < 0)
+        return ret;
+
+    s->status = data[0];
+    icm20608_parse_record(&data[1], s);
+    return 0;
+}
+/*陀螺仪各量程的灵敏度(0.1LSB/(°/s))和量程(°/s)*/
+static const unsigned int gyro_sens_x10[] = { 1310, 655, 328, 164 };
+static const unsigned int gyro_range_dps[] = { 250, 500, 1000, 2000 };
+/*加速度计各量程的灵敏度(LSB/g)和量程(g)*/
+static const unsigned int accel_sens[] = { 16384, 8192, 4096, 2048 };
+static const unsigned int accel_range_g[] = { 2, 4, 8, 16 };
+
+/*
+* @description : 根据配置计算实际生效的输出速率和灵敏度
+* @param - cfg : 采样配置
+*/
+static void icm20608_fill_config(struct icm20608_config *cfg)
+{
+    /*DLPF_CFG为0或7时内部采样率为8KHz, SMPLRT_DIV无效*/
+    if(cfg->gyro_dlpf == 0 || cfg->gyro_dlpf == 7)
+        cfg->odr_hz = 8000;
+    else
+        cfg->odr_hz = 1000 / (1 + cfg->smplrt_div);
+
+    memset(cfg->reserved, 0, sizeof(cfg->reserved));
+    cfg->gyro_sens_x10 = gyro_sens_x10[cfg->gyro_fs];
+    cfg->accel_sens = accel_sens[cfg->accel_fs];
+    cfg->temp_sens_x10 = ICM20608_TEMP_SENS_X10;
+}
+
+/*
+* @description : 设置采样率分频、量程和低通滤波, 调用者需持有dev->lock
+* @param - dev : icm20608设备
+* @param - cfg : 采样配置, 返回时填入实际生效的速率和灵敏度
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_set_config(struct icm20608_dev *dev, struct icm20608_config *cfg)
+{
+    int ret;
+    u8 data[5];
+
+    if(cfg->gyro_fs > ICM20608_GYRO_FS_2000DPS || cfg->accel_fs > ICM20608_ACCEL_FS_16G ||
+       cfg->gyro_dlpf > 7 || cfg->accel_dlpf > 7)
+        return -EINVAL;
+
+    /*SMPLRT_DIV(0x19)~ACCEL_CONFIG2(0x1D)地址连续, 一次突发写入*/
+    data[0] = cfg->smplrt_div;          /* 采样率分频 */
+    data[1] = cfg->gyro_dlpf;           /* CONFIG: 陀螺仪低通滤波 */
+    data[2] = cfg->gyro_fs << 3;        /* GYRO_CONFIG: 陀螺仪量程, FCHOICE_B=0 */
+    data[3] = cfg->accel_fs << 3;       /* ACCEL_CONFIG: 加速度计量程 */
+    data[4] = cfg->accel_dlpf;          /* ACCEL_CONFIG2: 加速度计低通滤波 */
+    ret = regmap_bulk_write(dev->regmap, ICM20_SMPLRT_DIV, data, 5);
+    if(ret < 0)
+        return ret;
+
+    icm20608_fill_config(cfg);
+    dev->cfg = *cfg;
+    return 0;
+}
+
+/*加速度计偏移寄存器地址, X/Y/Z三组之间不连续*/
+static const u8 accel_offs_reg[] = { ICM20_XA_OFFSET_H, ICM20_YA_OFFSET_H, ICM20_ZA_OFFSET_H };
+
+/*
+* @description : 读取偏移寄存器, 调用者需持有dev->lock
+* @param - dev : icm20608设备
+* @param - offs : 读取到的偏移值
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_read_offset(struct icm20608_dev *dev, struct icm20608_offset *offs)
+{
+    int i, ret;
+    u8 data[6];
+
+    /*陀螺仪偏移寄存器地址连续, 一次读取*/
+    ret = regmap_bulk_read(dev->regmap, ICM20_XG_OFFS_USRH, data, 6);
+    if(ret < 0)
+        return ret;
+    for(i = 0; i < 3; i++)
+        offs->gyro[i] = (s16)((data[2 * i] << 8) | data[2 * i + 1]);
+
+    /*加速度计偏移为15位, 存放在bit15~bit1*/
+    for(i = 0; i < 3; i++){
+        ret = regmap_bulk_read(dev->regmap, accel_offs_reg[i], data, 2);
+        if(ret < 0)
+            return ret;
+        offs->accel[i] = (s16)((data[0] << 8) | data[1]) >> 1;
+    }
+    return 0;
+}
+
+/*
+* @description : 写入偏移寄存器, 调用者需持有dev->lock
+* @param - dev : icm20608设备
+* @param - offs : 要写入的偏移值
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_write_offset(struct icm20608_dev *dev, const struct icm20608_offset *offs)
+{
+    int i, ret;
+    u8 data[6];
+    u16 value;
+
+    for(i = 0; i < 3; i++){
+        if(offs->accel[i] < -16384 || offs->accel[i] > 16383)
+            return -EINVAL;
+    }
+
+    for(i = 0; i < 3; i++){
+        data[2 * i] = (u16)offs->gyro[i] >> 8;
+        data[2 * i + 1] = offs->gyro[i] & 0xff;
+    }
+    ret = regmap_bulk_write(dev->regmap, ICM20_XG_OFFS_USRH, data, 6);
+    if(ret < 0)
+        return ret;
+
+    for(i = 0; i < 3; i++){
+        value = (u16)offs->accel[i] << 1;
+        data[0] = value >> 8;
+        data[1] = value & 0xfe;
+        ret = regmap_bulk_write(dev->regmap, accel_offs_reg[i], data, 2);
+        if(ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+* @description : 静止校准, 芯片水平静止且Z轴朝上, 测量零偏后写入偏移寄存器,
+*                调用者需持有dev->lock
+* @param - dev : icm20608设备
+* @param - calib : 输入平均次数, 返回测得的零偏和写入的偏移值
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_calibrate(struct icm20608_dev *dev, struct icm20608_calib *calib)
+{
+    int i, j, ret;
+    s32 sum[6] = { 0 };
+    unsigned int period_us;
+    struct icm20608_offset offs;
+
+    if(calib->samples == 0)
+        calib->samples = ICM20608_CALIB_SAMPLES;
+    if(calib->samples > ICM20608_CALIB_MAX_SAMPLES)
+        return -EINVAL;
+
+    /*陀螺仪偏移清零, 加速度计偏移恢复出厂值, 在此基础上测量零偏*/
+    offs = dev->factory;
+    ret = icm20608_write_offset(dev, &offs);
+    if(ret < 0)
+        return ret;
+
+    period_us = 1000000 / dev->cfg.odr_hz;
+    msleep(100);                                /*等待低通滤波器稳定*/
+
+    for(i = 0; i < calib->samples; i++){
+        usleep_range(period_us, period_us + 100);   /*每个输出周期取一次*/
+        ret = icm20608_readdata(dev, ktime_get_ns());
+        if(ret < 0)
+            return ret;
+        for(j = 0; j < 3; j++){
+            sum[j] += dev->sample.gyro[j];
+            sum[3 + j] += dev->sample.accel[j];
+        }
+    }
+
+    for(j = 0; j < 3; j++){
+        calib->gyro_bias[j] = sum[j] / (s32)calib->samples;
+        calib->accel_bias[j] = sum[3 + j] / (s32)calib->samples;
+    }
+    calib->accel_bias[2] -= accel_sens[dev->cfg.accel_fs];     /*Z轴朝上, 扣除1g重力*/
+
+    for(j = 0; j < 3; j++){
+        /*陀螺仪: 偏移量(LSB) = OFFS_USR * 4 / 2^FS_SEL*/
+        offs.gyro[j] = clamp_t(s32, -calib->gyro_bias[j] * (1 << dev->cfg.gyro_fs) / 4,
+                               S16_MIN, S16_MAX);
+        /*加速度计: 偏移寄存器1LSB约为1/1024g*/
+        offs.accel[j] = clamp_t(s32, dev->factory.accel[j] -
+                                calib->accel_bias[j] * (1 << dev->cfg.accel_fs) / 16,
+                                -16384, 16383);
+    }
+
+    ret = icm20608_write_offset(dev, &offs);
+    if(ret < 0)
+        return ret;
+    calib->offset = offs;
+    return 0;
+}
+
+/*
+* @description : 将原始值换算为定点物理量
+* @param - cfg : 当前采样配置
+* @param - s : 原始采样
+* @param - si : 换算结果
+*/
+static void icm20608_to_si(const struct icm20608_config *cfg, const struct icm20608_sample *s,
+                           struct icm20608_si_sample *si)
+{
+    int i;
+
+    si->timestamp = s->timestamp;
+    for(i = 0; i < 3; i++){
+        si->gyro[i] = (s32)s->gyro[i] * 10000 / (s32)cfg->gyro_sens_x10;
+        si->accel[i] = (s32)s->accel[i] * 1000 / (s32)cfg->accel_sens;
+    }
+    si->temp = ((s32)s->temp - 25) * 10000 / ICM20608_TEMP_SENS_X10 + 25000;
+    si->version = s->version;
+    si->status = s->status;
+    si->reserved[0] = 0;
+    si->reserved[1] = 0;
 }
 
-static void icm20608_readdata(struct icm20608_dev *dev)
+/*寄存器初始化表中的一项, delay_ms为写入后需要等待的时间*/
+struct icm20608_reg_init {
+    u8 reg;
+    u8 val;
+    unsigned int delay_ms;
+};
+
+#define ICM20608_MAX_BURST      8       /* 初始化表合并写入的最大字节数 */
+
+/*复位并唤醒, 复位后为0x40睡眠模式, 然后关闭睡眠, 自动选择时钟*/
+static const struct icm20608_reg_init icm20608_reset_seq[] = {
+    { ICM20_PWR_MGMT_1,     0x80,   50 },
+    { ICM20_PWR_MGMT_1,     0x01,   50 },
+};
+
+/*复位后的其余配置, 采样配置由icm20608_set_config写入*/
+static const struct icm20608_reg_init icm20608_init_seq[] = {
+    { ICM20_LP_MODE_CFG,    0x00,   0 },    /* 关闭低功耗 */
+    { ICM20_FIFO_EN,        0x00,   0 },    /* 关闭FIFO */
+    { ICM20_INT_PIN_CFG,    ICM20608_INT_ANYRD_2CLEAR, 0 },  /* INT高电平有效、推挽、50us脉冲 */
+    { ICM20_INT_ENABLE,     0x00,   0 },    /* 有读者时才打开数据就绪中断 */
+    { ICM20_PWR_MGMT_2,     0x00,   0 },    /* 打开加速度计和陀螺仪所有轴 */
+};
+
+/*
+* @description : 按表写寄存器, 地址连续且不需要等待的项合并成一次突发写入,
+*                等待使用msleep, 不占用CPU, 调用者需持有dev->lock
+* @param - dev : icm20608设备
+* @param - seq : 初始化表
+* @param - n : 表的项数
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_write_seq(struct icm20608_dev *dev, const struct icm20608_reg_init *seq, int n)
 {
-    unsigned char data[14];
-    icm20608_read_regs(dev, ICM20_ACCEL_XOUT_H, data, 14);
+    int i = 0, len, ret;
+    u8 data[ICM20608_MAX_BURST];
 
-    dev->accel_x_adc = (signed short)((data[0] << 8) | data[1]); 
-	dev->accel_y_adc = (signed short)((data[2] << 8) | data[3]); 
-	dev->accel_z_adc = (signed short)((data[4] << 8) | data[5]); 
-	dev->temp_adc    = (signed short)((data[6] << 8) | data[7]); 
-	dev->gyro_x_adc  = (signed short)((data[8] << 8) | data[9]); 
-	dev->gyro_y_adc  = (signed short)((data[10] << 8) | data[11]);
-	dev->gyro_z_adc  = (signed short)((data[12] << 8) | data[13]);
+    while(i < n){
+        data[0] = seq[i].val;
+        len = 1;
+        while(i + len < n && len < ICM20608_MAX_BURST && seq[i + len - 1].delay_ms == 0 &&
+              seq[i + len].reg == seq[i].reg + len){
+            data[len] = seq[i + len].val;
+            len++;
+        }
+
+        ret = regmap_bulk_write(dev->regmap, seq[i].reg, data, len);
+        if(ret < 0)
+            return ret;
+        i += len;
+        if(seq[i - 1].delay_ms)
+            msleep(seq[i - 1].delay_ms);
+    }
+    return 0;
 }
-static void icm20608reg_init(void)
+
+static int icm20608reg_init(struct icm20608_dev *dev)
 {
+    int ret;
     u8 value = 0;
+    struct icm20608_config cfg;
 
-    icm20608_writeone(&icm20608dev, ICM20_PWR_MGMT_1, 0x80);		/* 复位，复位后为0x40,睡眠模式 */
-	mdelay(50);
-	icm20608_writeone(&icm20608dev, ICM20_PWR_MGMT_1, 0x01);		/* 关闭睡眠，自动选择时钟 */
-	mdelay(50);
+    mutex_lock(&dev->lock);
+    ret = icm20608_write_seq(dev, icm20608_reset_seq, ARRAY_SIZE(icm20608_reset_seq));
+    if(ret < 0)
+        goto out;
+    regcache_drop_region(dev->regmap, 0, ICM20_ZA_OFFSET_L);    /* 复位后缓存失效 */
 
-    value = icm20608_readone(&icm20608dev, 0x75);
+    value = icm20608_readone(dev, ICM20_WHO_AM_I);
     printk("ICM20608 ID= %#X\r\n", value);
 
-    icm20608_writeone(&icm20608dev, ICM20_SMPLRT_DIV, 0x00); 	    /* 输出速率是内部采样率	*/
-	icm20608_writeone(&icm20608dev, ICM20_GYRO_CONFIG, 0x18); 	    /* 陀螺仪±2000dps量程 */
-	icm20608_writeone(&icm20608dev, ICM20_ACCEL_CONFIG, 0x18); 	    /* 加速度计±16G量程 */
-	icm20608_writeone(&icm20608dev, ICM20_CONFIG, 0x04); 		    /* 陀螺仪低通滤波BW=20Hz */
-	icm20608_writeone(&icm20608dev, ICM20_ACCEL_CONFIG2, 0x04); 	/* 加速度计低通滤波BW=21.2Hz */
-	icm20608_writeone(&icm20608dev, ICM20_PWR_MGMT_2, 0x00); 	    /* 打开加速度计和陀螺仪所有轴 */
-	icm20608_writeone(&icm20608dev, ICM20_LP_MODE_CFG, 0x00); 	    /* 关闭低功耗 */
-	icm20608_writeone(&icm20608dev, ICM20_FIFO_EN, 0x00);		    /* 关闭FIFO	 */
+    /*复位后加速度计偏移寄存器为出厂校准值, 陀螺仪偏移为0*/
+    icm20608_read_offset(dev, &dev->factory);
+
+    /*默认配置: 输出速率是内部采样率, 陀螺仪±2000dps, 加速度计±16G,
+      陀螺仪低通滤波BW=20Hz, 加速度计低通滤波BW=21.2Hz*/
+    cfg.smplrt_div = 0;
+    cfg.gyro_fs = ICM20608_GYRO_FS_2000DPS;
+    cfg.accel_fs = ICM20608_ACCEL_FS_16G;
+    cfg.gyro_dlpf = 4;
+    cfg.accel_dlpf = 4;
+    ret = icm20608_set_config(dev, &cfg);
+    if(ret < 0)
+        goto out;
+
+    ret = icm20608_write_seq(dev, icm20608_init_seq, ARRAY_SIZE(icm20608_init_seq));
+out:
+    mutex_unlock(&dev->lock);
+    return ret;
 }
 
 
-static int icm20608_open (struct inode *inode, struct file *filp)
+/*
+* @description : 将一个采样写入共享环形缓冲区并唤醒所有读者, 缓冲区满时覆盖最旧的采样
+* @param - dev : icm20608设备
+* @param - s : 采样
+*/
+static void icm20608_push_sample(struct icm20608_dev *dev, const struct icm20608_sample *s)
 {
-    printk("icm20608_open\r\n");
-    filp->private_data = &icm20608dev;
+    spin_lock(&dev->ring_lock);
+    dev->ring[dev->head & (ICM20608_RING_LEN - 1)] = *s;
+    dev->head++;
+    spin_unlock(&dev->ring_lock);
+
+    wake_up_interruptible(&dev->r_wait);
+}
+
+/*
+* @description : 按文件的读位置取出一个采样, 读者落后超过缓冲区长度时
+*                跳到最旧的有效采样并累计丢失个数
+* @param - dev : icm20608设备
+* @param - priv : 文件私有数据
+* @param - s : 取出的采样
+* @return : true 取到采样, false 没有新的采样
+*/
+static bool icm20608_ring_get(struct icm20608_dev *dev, struct icm20608_file *priv,
+                              struct icm20608_sample *s)
+{
+    bool ret = false;
+    unsigned int avail;
+
+    spin_lock(&dev->ring_lock);
+    avail = dev->head - priv->tail;
+    if(avail > ICM20608_RING_LEN){
+        priv->dropped += avail - ICM20608_RING_LEN;
+        priv->tail = dev->head - ICM20608_RING_LEN;
+    }
+    if(avail){
+        *s = dev->ring[priv->tail & (ICM20608_RING_LEN - 1)];
+        priv->tail++;
+        ret = true;
+    }
+    spin_unlock(&dev->ring_lock);
+    return ret;
+}
+
+/*
+* @description : 文件是否有未读的采样
+*/
+static bool icm20608_ring_avail(struct icm20608_dev *dev, struct icm20608_file *priv)
+{
+    return READ_ONCE(dev->head) != READ_ONCE(priv->tail);
+}
+
+/*
+* @description : 抽取滤波, 每factor个输入产生一个输出, 调用者需持有dev->lock
+* @param - dev : icm20608设备
+* @param - s : 输入采样, 有输出时替换为滤波后的采样, 时间戳为窗口内最新输入的时间戳
+* @return : true 产生了一个输出, false 没有输出
+*/
+static bool icm20608_decimate(struct icm20608_dev *dev, struct icm20608_sample *s)
+{
+    int ch, k;
+    s32 acc;
+    unsigned int idx;
+    s16 in[ICM20608_CHANNELS];
+    struct icm20608_decim *d = &dev->decim;
+    struct icm20608_decim_state *st = &dev->dstate;
+
+    if(d->ntaps == 0)       /* 不抽取也不滤波 */
+        return true;
+
+    in[0] = s->gyro[0];  in[1] = s->gyro[1];  in[2] = s->gyro[2];
+    in[3] = s->accel[0]; in[4] = s->accel[1]; in[5] = s->accel[2];
+    in[6] = s->temp;
+
+    for(ch = 0; ch < ICM20608_CHANNELS; ch++)
+        st->hist[ch][st->pos] = in[ch];
+    st->pos = (st->pos + 1) & (ICM20608_DECIM_MAX_TAPS - 1);
+
+    if(++st->phase < d->factor)
+        return false;
+    st->phase = 0;
+
+    /*只在需要输出时计算FIR, Q15定点乘加*/
+    for(ch = 0; ch < ICM20608_CHANNELS; ch++){
+        acc = 0;
+        idx = st->pos;
+        for(k = 0; k < d->ntaps; k++){
+            idx = (idx - 1) & (ICM20608_DECIM_MAX_TAPS - 1);
+            acc += (s32)d->coeffs[k] * st->hist[ch][idx];
+        }
+        in[ch] = clamp_t(s32, (acc + (1 << 14)) >> 15, S16_MIN, S16_MAX);
+    }
+
+    s->gyro[0] = in[0];  s->gyro[1] = in[1];  s->gyro[2] = in[2];
+    s->accel[0] = in[3]; s->accel[1] = in[4]; s->accel[2] = in[5];
+    s->temp = in[6];
+    return true;
+}
+
+/*
+* @description : 检查并设置抽取滤波配置, ntaps为0且factor大于1时生成boxcar系数,
+*                factor为1且ntaps为0时直接透传采样
+* @param - d : 抽取滤波配置
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_check_decim(struct icm20608_decim *d)
+{
+    int k;
+    u32 sum = 0;
+
+    if(d->factor < 1 || d->factor > ICM20608_DECIM_MAX_FACTOR)
+        return -EINVAL;
+    if(d->ntaps > ICM20608_DECIM_MAX_TAPS)
+        return -EINVAL;
+
+    if(d->ntaps == 0 && d->factor > 1){
+        d->ntaps = d->factor;
+        for(k = 0; k < ICM20608_DECIM_MAX_TAPS; k++)
+            d->coeffs[k] = k < d->factor ? 32768 / d->factor : 0;
+    }
+
+    /*保证Q15乘加不会溢出s32*/
+    for(k = 0; k < d->ntaps; k++)
+        sum += abs(d->coeffs[k]);
+    if(sum >= 65536)
+        return -EINVAL;
     return 0;
 }
 
-static ssize_t icm20608_read (struct file *filp, char __user *buf, size_t cnt, loff_t *off_t)
+/*
+* @description : 根据抽取配置和读者个数打开或关闭芯片FIFO, 有中断且需要抽取时
+*                每factor个数据就绪中断成批读取一次FIFO, 调用者需持有dev->lock
+* @param - dev : icm20608设备
+*/
+static void icm20608_fifo_setup(struct icm20608_dev *dev)
+{
+    bool on = dev->irq > 0 && dev->users > 0 && dev->decim.factor > 1;
+
+    icm20608_writeone(dev, ICM20_USER_CTRL, ICM20608_USER_FIFO_RST);   /* 关闭并复位FIFO */
+    regmap_update_bits(dev->regmap, ICM20_FIFO_EN, 0xFF, on ? ICM20608_FIFO_EN_ALL : 0x00);
+    if(on)
+        icm20608_writeone(dev, ICM20_USER_CTRL, ICM20608_USER_FIFO_EN);
+
+    dev->fifo_mode = on;
+    dev->irq_count = 0;
+    memset(&dev->dstate, 0, sizeof(dev->dstate));
+}
+
+/*
+* @description : 成批读取FIFO中的采样, 经抽取滤波后放入共享缓冲区,
+*                调用者需持有dev->lock
+* @param - dev : icm20608设备
+* @param - timestamp : 最新一个采样的数据就绪时刻
+*/
+static void icm20608_fifo_read(struct icm20608_dev *dev, s64 timestamp)
+{
+    int i, n, ret;
+    u8 data[2];
+    unsigned int status = 0;
+    u32 period_ns = 1000000000U / dev->cfg.odr_hz;
+    struct icm20608_sample s;
+
+    ret = regmap_read(dev->regmap, ICM20_INT_STATUS, &status);
+    if(ret < 0)
+        return;
+    if(status & ICM20608_FIFO_OFLOW_INT){       /* FIFO溢出, 数据已不连续 */
+        printk("%s: fifo overflow\r\n", dev_name(&((struct spi_device *)dev->private_data)->dev));
+        icm20608_fifo_setup(dev);
+        return;
+    }
+
+    ret = regmap_bulk_read(dev->regmap, ICM20_FIFO_COUNTH, data, 2);
+    if(ret < 0)
+        return;
+    n = ((data[0] << 8) | data[1]) / ICM20608_RECORD_LEN;
+    n = min(n, ICM20608_FIFO_MAX_RECORDS);
+    if(n == 0)
+        return;
+
+    /*FIFO_R_W地址不自动递增, 一次突发读出所有采样;
+      regmap的突发读要求地址范围都在max_register以内, FIFO直接用icm20608_read_regs读取*/
+    ret = icm20608_read_regs(dev, ICM20_FIFO_R_W, dev->fifo_buf, n * ICM20608_RECORD_LEN);
+    icm20608_stats_add(dev, &dev->stats.sample, ktime_get_ns() - timestamp,
+                       n * ICM20608_RECORD_LEN, ret);
+    if(ret < 0)
+        return;
+
+    for(i = 0; i < n; i++){
+        icm20608_parse_record(&dev->fifo_buf[i * ICM20608_RECORD_LEN], &s);
+        s.status = status;
+        s.timestamp = timestamp - (s64)(n - 1 - i) * period_ns;
+        if(icm20608_decimate(dev, &s))
+            icm20608_push_sample(dev, &s);
+    }
+}
+
+/*
+* @description : 数据就绪中断上半部, 只记录时间戳
+*/
+static irqreturn_t icm20608_irq_handler(int irq, void *dev_id)
+{
+    struct icm20608_dev *dev = dev_id;
+
+    dev->irq_ts = ktime_get_ns();
+
+    /*FIFO模式下每factor个采样才唤醒一次中断线程*/
+    if(dev->fifo_mode && ++dev->irq_count < dev->decim.factor)
+        return IRQ_HANDLED;
+    dev->irq_count = 0;
+    return IRQ_WAKE_THREAD;
+}
+
+/*
+* @description : 数据就绪中断线程, 读取采样放入共享环形缓冲区
+*/
+static irqreturn_t icm20608_irq_thread(int irq, void *dev_id)
+{
+    int ret;
+    struct icm20608_sample s;
+    struct icm20608_dev *dev = dev_id;
+
+    mutex_lock(&dev->lock);
+    if(dev->fifo_mode){
+        icm20608_fifo_read(dev, dev->irq_ts);
+    }else{
+        ret = icm20608_readdata(dev, dev->irq_ts);
+        s = dev->sample;
+        if(ret == 0 && icm20608_decimate(dev, &s))
+            icm20608_push_sample(dev, &s);
+    }
+    mutex_unlock(&dev->lock);
+
+    return IRQ_HANDLED;
+}
+
+/*
+* @description : 没有数据就绪中断时的采集线程, 有读者时按ODR周期采样
+*/
+static int icm20608_poll_thread(void *data)
+{
+    int ret;
+    unsigned int period_us;
+    struct icm20608_sample s;
+    struct icm20608_dev *dev = data;
+
+    while(!kthread_should_stop()){
+        if(!READ_ONCE(dev->users)){
+            wait_event_interruptible(dev->poll_wait,
+                                     READ_ONCE(dev->users) || kthread_should_stop());
+            continue;
+        }
+
+        mutex_lock(&dev->lock);
+        ret = icm20608_readdata(dev, ktime_get_ns());
+        s = dev->sample;
+        period_us = 1000000 / dev->cfg.odr_hz;
+        if(ret == 0 && icm20608_decimate(dev, &s))
+            icm20608_push_sample(dev, &s);
+        mutex_unlock(&dev->lock);
+
+        usleep_range(period_us, period_us + period_us / 8);
+    }
+    return 0;
+}
+
+/*
+* @description : 开始或停止采集, 调用者需持有dev->lock
+* @param - dev : icm20608设备
+* @param - on : true 开始, false 停止
+*/
+static void icm20608_stream_enable(struct icm20608_dev *dev, bool on)
+{
+    if(dev->irq <= 0){
+        if(on)
+            wake_up_interruptible(&dev->poll_wait);     /*唤醒轮询线程*/
+        return;
+    }
+
+    if(on){
+        icm20608_fifo_setup(dev);
+        regmap_update_bits(dev->regmap, ICM20_INT_ENABLE, ICM20608_DATA_RDY_INT_EN,
+                           ICM20608_DATA_RDY_INT_EN);
+    }else{
+        regmap_update_bits(dev->regmap, ICM20_INT_ENABLE, ICM20608_DATA_RDY_INT_EN, 0x00);
+        icm20608_fifo_setup(dev);
+    }
+}
+
+/*
+* @description : 各数据格式下一个采样的长度
+*/
+static size_t icm20608_record_size(int format)
+{
+    switch(format) {
+        case ICM20608_FMT_LEGACY:
+            return 7 * sizeof(signed int);
+        case ICM20608_FMT_SI:
+            return sizeof(struct icm20608_si_sample);
+        default:
+            return sizeof(struct icm20608_sample);
+    }
+}
+
+/*
+* @description : 按文件的数据格式将一个采样复制到用户空间
+* @param - format : 数据格式
+* @param - cfg : 采样配置, 用于换算物理量
+* @param - s : 原始采样
+* @param - buf : 用户空间缓冲区
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_copy_sample(int format, const struct icm20608_config *cfg,
+                                const struct icm20608_sample *s, char __user *buf)
 {
-    int err = 0;
     signed int data[7];
-    struct icm20608_dev *dev = (struct icm20608_dev *)filp->private_data;
+    struct icm20608_si_sample si;
+
+    if(format == ICM20608_FMT_SI){
+        icm20608_to_si(cfg, s, &si);
+        if(copy_to_user(buf, &si, sizeof(si)))
+            return -EFAULT;
+        return 0;
+    }
+
+    if(format == ICM20608_FMT_LEGACY){
+        data[0] = s->gyro[0];
+        data[1] = s->gyro[1];
+        data[2] = s->gyro[2];
+
+        data[3] = s->accel[0];
+        data[4] = s->accel[1];
+        data[5] = s->accel[2];
+
+        data[6] = s->temp;
+
+        if(copy_to_user(buf, data, sizeof(data)))
+            return -EFAULT;
+        return 0;
+    }
+
+    if(copy_to_user(buf, s, sizeof(*s)))
+        return -EFAULT;
+    return 0;
+}
+
+/*
+* @description : 从设备读取数据, 阻塞等待新的采样, 每个文件独立读取同一个采集流,
+*                紧凑/定点格式一次返回缓冲区能放下的所有采样
+* @param - filp : 设备文件
+* @param - buf : 返回给用户空间的数据缓冲区
+* @param - cnt : 要读取的数据长度
+* @param - offt : 相对于文件首地址的偏移
+* @return : 紧凑/定点格式返回读取的字节数; 旧格式返回0; 负值表示读取失败
+*/
+static ssize_t icm20608_read (struct file *filp, char __user *buf, size_t cnt, loff_t *off_t)
+{
+    int ret = 0;
+    size_t done = 0;
+    struct icm20608_file *priv = filp->private_data;
+    struct icm20608_dev *dev = priv->dev;
+    size_t rec = icm20608_record_size(priv->format);
+    struct icm20608_sample s;
+    struct icm20608_config cfg;
+
+    if(cnt < rec)
+        return -EINVAL;
+
+    mutex_lock(&dev->lock);
+    cfg = dev->cfg;
+    mutex_unlock(&dev->lock);
+
+    while(done == 0){
+        /*等待新的采样*/
+        if(!icm20608_ring_avail(dev, priv)){
+            if(READ_ONCE(dev->removed))     /*设备已经remove, 不会再有新的采样*/
+                return -ENODEV;
+            if(filp->f_flags & O_NONBLOCK)
+                return -EAGAIN;
+            ret = wait_event_interruptible(dev->r_wait, icm20608_ring_avail(dev, priv) ||
+                                           READ_ONCE(dev->removed));
+            if(ret)
+                return ret;
+            continue;
+        }
+
+        while(cnt - done >= rec && icm20608_ring_get(dev, priv, &s)){
+            ret = icm20608_copy_sample(priv->format, &cfg, &s, buf + done);
+            if(ret < 0)
+                return done ? done : ret;
+            done += rec;
+
+            if(priv->format == ICM20608_FMT_LEGACY)
+                return 0;               /*旧格式每次只返回一个采样*/
+        }
+    }
+    return done;
+}
+
+/*
+* @description : poll函数, 本文件有未读的采样时返回POLLIN
+*/
+static unsigned int icm20608_poll(struct file *filp, poll_table *wait)
+{
+    unsigned int mask = 0;
+    struct icm20608_file *priv = filp->private_data;
+    struct icm20608_dev *dev = priv->dev;
+
+    poll_wait(filp, &dev->r_wait, wait);
+    if(icm20608_ring_avail(dev, priv))
+        mask = POLLIN | POLLRDNORM;
+    else if(READ_ONCE(dev->removed))
+        mask = POLLERR | POLLHUP;
+    return mask;
+}
+
+/*
+* @description : 最后一个引用释放时释放设备结构体, 此时probe的引用和所有打开的文件都已释放
+*/
+static void icm20608_free(struct kref *ref)
+{
+    kfree(container_of(ref, struct icm20608_dev, ref));
+}
 
-    icm20608_readdata(dev);
+static int icm20608_open (struct inode *inode, struct file *filp)
+{
+    struct icm20608_file *priv;
+    struct icm20608_dev *dev;
 
-    data[0] = dev->gyro_x_adc;
-    data[1] = dev->gyro_y_adc;
-    data[2] = dev->gyro_z_adc;
+    printk("icm20608_open\r\n");
+    /*设备可能正在remove, 在icm20608_idr_lock中查找并取得引用*/
+    mutex_lock(&icm20608_idr_lock);
+    dev = idr_find(&icm20608_idr, iminor(inode));
+    /*cdev_add之后设备节点就可以打开, 异步初始化还没有完全结束*/
+    if(dev && !smp_load_acquire(&dev->ready)){
+        mutex_unlock(&icm20608_idr_lock);
+        return -EAGAIN;
+    }
+    if(dev)
+        kref_get(&dev->ref);
+    mutex_unlock(&icm20608_idr_lock);
+    if(!dev)
+        return -ENODEV;
 
-    data[3] = dev->accel_x_adc;
-    data[4] = dev->accel_y_adc;
-    data[5] = dev->accel_z_adc;
+    priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+    if(!priv){
+        kref_put(&dev->ref, icm20608_free);
+        return -ENOMEM;
+    }
 
-    data[6] = dev->temp_adc;
+    priv->dev = dev;
+    priv->format = ICM20608_FMT_SAMPLE;     /*默认使用紧凑格式*/
+    filp->private_data = priv;
 
-    err = copy_to_user(buf, data, sizeof(data));
-    // printk("icm20608_read\r\n");
+    /*从最新的采样开始读, 第一个读者打开时开始采集*/
+    mutex_lock(&dev->lock);
+    spin_lock(&dev->ring_lock);
+    priv->tail = dev->head;
+    spin_unlock(&dev->ring_lock);
+    if(dev->users++ == 0 && !dev->removed)
+        icm20608_stream_enable(dev, true);
+    mutex_unlock(&dev->lock);
     return 0;
 }
 
+static long icm20608_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    int ret = 0;
+    int value = 0;
+    struct icm20608_config cfg;
+    struct icm20608_calib calib;
+    struct icm20608_offset offs;
+    struct icm20608_decim decim;
+    struct icm20608_file *priv = filp->private_data;
+    struct icm20608_dev *dev = priv->dev;
+
+    switch(cmd) {
+        case ICM20608_SET_FORMAT:
+            if(copy_from_user(&value, (int __user *)arg, sizeof(int)))
+                return -EFAULT;
+            if(value != ICM20608_FMT_LEGACY && value != ICM20608_FMT_SAMPLE &&
+               value != ICM20608_FMT_SI)
+                return -EINVAL;
+            priv->format = value;
+            break;
+        case ICM20608_GET_FORMAT:
+            value = priv->format;
+            if(copy_to_user((int __user *)arg, &value, sizeof(int)))
+                return -EFAULT;
+            break;
+        case ICM20608_SET_CONFIG:
+            if(copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+                return -EFAULT;
+            mutex_lock(&dev->lock);
+            ret = dev->removed ? -ENODEV : icm20608_set_config(dev, &cfg);
+            mutex_unlock(&dev->lock);
+            if(ret < 0)
+                return ret;
+            if(copy_to_user((void __user *)arg, &cfg, sizeof(cfg)))
+                return -EFAULT;
+            break;
+        case ICM20608_GET_CONFIG:
+            mutex_lock(&dev->lock);
+            cfg = dev->cfg;
+            mutex_unlock(&dev->lock);
+            if(copy_to_user((void __user *)arg, &cfg, sizeof(cfg)))
+                return -EFAULT;
+            break;
+        case ICM20608_CALIBRATE:
+            if(copy_from_user(&calib, (void __user *)arg, sizeof(calib)))
+                return -EFAULT;
+            mutex_lock(&dev->lock);
+            ret = dev->removed ? -ENODEV : icm20608_calibrate(dev, &calib);
+            mutex_unlock(&dev->lock);
+            if(ret < 0)
+                return ret;
+            if(copy_to_user((void __user *)arg, &calib, sizeof(calib)))
+                return -EFAULT;
+            break;
+        case ICM20608_GET_OFFSET:
+            mutex_lock(&dev->lock);
+            ret = dev->removed ? -ENODEV : icm20608_read_offset(dev, &offs);
+            mutex_unlock(&dev->lock);
+            if(ret < 0)
+                return ret;
+            if(copy_to_user((void __user *)arg, &offs, sizeof(offs)))
+                return -EFAULT;
+            break;
+        case ICM20608_SET_OFFSET:       /*恢复之前保存的用户校准值*/
+            if(copy_from_user(&offs, (void __user *)arg, sizeof(offs)))
+                return -EFAULT;
+            mutex_lock(&dev->lock);
+            ret = dev->removed ? -ENODEV : icm20608_write_offset(dev, &offs);
+            mutex_unlock(&dev->lock);
+            break;
+        case ICM20608_RESET_OFFSET:
+            mutex_lock(&dev->lock);
+            ret = dev->removed ? -ENODEV : icm20608_write_offset(dev, &dev->factory);
+            mutex_unlock(&dev->lock);
+            break;
+        case ICM20608_GET_DROPPED:
+            spin_lock(&dev->ring_lock);
+            value = priv->dropped;
+            spin_unlock(&dev->ring_lock);
+            if(copy_to_user((int __user *)arg, &value, sizeof(int)))
+                return -EFAULT;
+            break;
+        case ICM20608_SET_DECIM:
+            if(copy_from_user(&decim, (void __user *)arg, sizeof(decim)))
+                return -EFAULT;
+            ret = icm20608_check_decim(&decim);
+            if(ret < 0)
+                return ret;
+            mutex_lock(&dev->lock);
+            dev->decim = decim;
+            if(dev->removed)
+                ret = -ENODEV;
+            else
+                icm20608_fifo_setup(dev);
+            mutex_unlock(&dev->lock);
+            break;
+        case ICM20608_GET_DECIM:
+            mutex_lock(&dev->lock);
+            decim = dev->decim;
+            mutex_unlock(&dev->lock);
+            if(copy_to_user((void __user *)arg, &decim, sizeof(decim)))
+                return -EFAULT;
+            break;
+        default:
+            return -ENOTTY;
+    }
+    return ret;
+}
+
 static int icm20608_release (struct inode *inode, struct file *filp)
 {
+    struct icm20608_file *priv = filp->private_data;
+    struct icm20608_dev *dev = priv->dev;
+
     printk("icm20608_release\r\n");
+
+    /*最后一个读者关闭时停止采集, remove时已经停止*/
+    mutex_lock(&dev->lock);
+    if(--dev->users == 0 && !dev->removed)
+        icm20608_stream_enable(dev, false);
+    mutex_unlock(&dev->lock);
+
+    kfree(priv);
+    kref_put(&dev->ref, icm20608_free);     /*remove之后最后一个文件关闭时释放设备*/
     return 0;
 }
 /*字符设备操作集*/
@@ -203,111 +1276,545 @@ static struct file_operations icm20608_fops = {
     .owner	 = THIS_MODULE,
     .open	 = icm20608_open,
     .read	 = icm20608_read,
+    .unlocked_ioctl = icm20608_ioctl,
+    .poll    = icm20608_poll,
     .release = icm20608_release
 };
 
-static int icm20608_probe(struct spi_device *spi)
+/*sysfs属性对应的配置项*/
+enum icm20608_attr_field {
+    ICM20608_ATTR_SMPLRT_DIV,
+    ICM20608_ATTR_GYRO_RANGE,
+    ICM20608_ATTR_ACCEL_RANGE,
+    ICM20608_ATTR_GYRO_DLPF,
+    ICM20608_ATTR_ACCEL_DLPF,
+};
+
+/*
+* @description : 通过sysfs修改一项采样配置
+* @param - device : 设备
+* @param - buf : 用户写入的字符串
+* @param - count : 字符串长度
+* @param - field : 要修改的配置项
+* @return : 成功返回count，<0 失败
+*/
+static ssize_t icm20608_store_field(struct device *device, const char *buf, size_t count, int field)
+{
+    int i, ret;
+    unsigned int value;
+    struct icm20608_config cfg;
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+
+    ret = kstrtouint(buf, 0, &value);
+    if(ret)
+        return ret;
+
+    mutex_lock(&dev->lock);
+    cfg = dev->cfg;
+    ret = -EINVAL;
+    switch(field) {
+        case ICM20608_ATTR_SMPLRT_DIV:
+            if(value <= 255){
+                cfg.smplrt_div = value;
+                ret = 0;
+            }
+            break;
+        case ICM20608_ATTR_GYRO_RANGE:      /*写入量程(°/s)*/
+            for(i = 0; i < ARRAY_SIZE(gyro_range_dps); i++){
+                if(gyro_range_dps[i] == value){
+                    cfg.gyro_fs = i;
+                    ret = 0;
+                }
+            }
+            break;
+        case ICM20608_ATTR_ACCEL_RANGE:     /*写入量程(g)*/
+            for(i = 0; i < ARRAY_SIZE(accel_range_g); i++){
+                if(accel_range_g[i] == value){
+                    cfg.accel_fs = i;
+                    ret = 0;
+                }
+            }
+            break;
+        case ICM20608_ATTR_GYRO_DLPF:
+            cfg.gyro_dlpf = value;
+            ret = value <= 7 ? 0 : -EINVAL;
+            break;
+        case ICM20608_ATTR_ACCEL_DLPF:
+            cfg.accel_dlpf = value;
+            ret = value <= 7 ? 0 : -EINVAL;
+            break;
+    }
+    if(ret == 0)
+        ret = icm20608_set_config(dev, &cfg);
+    mutex_unlock(&dev->lock);
+
+    return ret < 0 ? ret : count;
+}
+
+static ssize_t smplrt_div_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u\n", dev->cfg.smplrt_div);
+}
+
+static ssize_t smplrt_div_store(struct device *device, struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+    return icm20608_store_field(device, buf, count, ICM20608_ATTR_SMPLRT_DIV);
+}
+
+static ssize_t gyro_range_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u\n", gyro_range_dps[dev->cfg.gyro_fs]);
+}
+
+static ssize_t gyro_range_store(struct device *device, struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+    return icm20608_store_field(device, buf, count, ICM20608_ATTR_GYRO_RANGE);
+}
+
+static ssize_t accel_range_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u\n", accel_range_g[dev->cfg.accel_fs]);
+}
+
+static ssize_t accel_range_store(struct device *device, struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+    return icm20608_store_field(device, buf, count, ICM20608_ATTR_ACCEL_RANGE);
+}
+
+static ssize_t gyro_dlpf_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u\n", dev->cfg.gyro_dlpf);
+}
+
+static ssize_t gyro_dlpf_store(struct device *device, struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    return icm20608_store_field(device, buf, count, ICM20608_ATTR_GYRO_DLPF);
+}
+
+static ssize_t accel_dlpf_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u\n", dev->cfg.accel_dlpf);
+}
+
+static ssize_t accel_dlpf_store(struct device *device, struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+    return icm20608_store_field(device, buf, count, ICM20608_ATTR_ACCEL_DLPF);
+}
+
+/*实际输出速率(Hz)*/
+static ssize_t odr_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u\n", dev->cfg.odr_hz);
+}
+
+/*陀螺仪灵敏度, LSB/(°/s)*/
+static ssize_t gyro_sensitivity_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u.%u\n", dev->cfg.gyro_sens_x10 / 10, dev->cfg.gyro_sens_x10 % 10);
+}
+
+/*加速度计灵敏度, LSB/g*/
+static ssize_t accel_sensitivity_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u\n", dev->cfg.accel_sens);
+}
+
+/*抽取倍数, 写入时使用boxcar滤波*/
+static ssize_t decimation_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+    return sprintf(buf, "%u\n", dev->decim.factor);
+}
+
+static ssize_t decimation_store(struct device *device, struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+    int ret;
+    struct icm20608_decim decim;
+    struct icm20608_dev *dev = dev_get_drvdata(device);
+
+    memset(&decim, 0, sizeof(decim));
+    ret = kstrtouint(buf, 0, &decim.factor);
+    if(ret)
+        return ret;
+    ret = icm20608_check_decim(&decim);
+    if(ret < 0)
+        return ret;
+
+    mutex_lock(&dev->lock);
+    dev->decim = decim;
+    icm20608_fifo_setup(dev);
+    mutex_unlock(&dev->lock);
+    return count;
+}
+
+static DEVICE_ATTR_RW(smplrt_div);
+static DEVICE_ATTR_RW(gyro_range);
+static DEVICE_ATTR_RW(accel_range);
+static DEVICE_ATTR_RW(gyro_dlpf);
+static DEVICE_ATTR_RW(accel_dlpf);
+static DEVICE_ATTR_RO(odr);
+static DEVICE_ATTR_RO(gyro_sensitivity);
+static DEVICE_ATTR_RO(accel_sensitivity);
+static DEVICE_ATTR_RW(decimation);
+
+static struct attribute *icm20608_attrs[] = {
+    &dev_attr_smplrt_div.attr,
+    &dev_attr_gyro_range.attr,
+    &dev_attr_accel_range.attr,
+    &dev_attr_gyro_dlpf.attr,
+    &dev_attr_accel_dlpf.attr,
+    &dev_attr_odr.attr,
+    &dev_attr_gyro_sensitivity.attr,
+    &dev_attr_accel_sensitivity.attr,
+    &dev_attr_decimation.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(icm20608);
+
+/*
+* @description : 打印一类操作的统计和非空的直方图桶
+*/
+static void icm20608_stats_show_one(struct seq_file *m, const char *name,
+                                    const struct icm20608_xfer_stats *st)
+{
+    int k;
+
+    seq_printf(m, "%s: count=%llu bytes=%llu errors=%llu stalls=%llu avg_ns=%llu max_ns=%llu\n",
+               name, st->count, st->bytes, st->errors, st->stalls,
+               st->count ? div64_u64(st->total_ns, st->count) : 0, st->max_ns);
+    for(k = 0; k < ICM20608_HIST_BUCKETS; k++){
+        if(st->hist[k])
+            seq_printf(m, "  [%10llu, %10llu) ns: %u\n",
+                       1ULL << k, 1ULL << (k + 1), st->hist[k]);
+    }
+}
+
+static int icm20608_stats_show(struct seq_file *m, void *v)
+{
+    struct icm20608_dev *dev = m->private;
+    struct icm20608_xfer_stats *st;
+
+    /*先拷贝一份, 避免在spinlock中调用seq_printf*/
+    st = kmalloc(3 * sizeof(*st), GFP_KERNEL);
+    if(!st)
+        return -ENOMEM;
+    spin_lock(&dev->stats.lock);
+    st[0] = dev->stats.read;
+    st[1] = dev->stats.write;
+    st[2] = dev->stats.sample;
+    spin_unlock(&dev->stats.lock);
+
+    seq_printf(m, "stall_us=%u\n", READ_ONCE(stall_us));
+    icm20608_stats_show_one(m, "read", &st[0]);
+    icm20608_stats_show_one(m, "write", &st[1]);
+    icm20608_stats_show_one(m, "sample", &st[2]);
+    kfree(st);
+    return 0;
+}
+
+static int icm20608_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, icm20608_stats_show, inode->i_private);
+}
+
+/*向stats写入任意内容清零统计*/
+static ssize_t icm20608_stats_write(struct file *file, const char __user *buf,
+                                    size_t count, loff_t *ppos)
+{
+    struct icm20608_dev *dev = ((struct seq_file *)file->private_data)->private;
+
+    spin_lock(&dev->stats.lock);
+    memset(&dev->stats.read, 0, sizeof(dev->stats.read));
+    memset(&dev->stats.write, 0, sizeof(dev->stats.write));
+    memset(&dev->stats.sample, 0, sizeof(dev->stats.sample));
+    spin_unlock(&dev->stats.lock);
+    return count;
+}
+
+static const struct file_operations icm20608_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = icm20608_stats_open,
+    .read = seq_read,
+    .write = icm20608_stats_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/*
+* @description : 创建/sys/kernel/debug/icm20608/<spi设备名>/stats,
+*                debugfs不可用时不影响驱动工作
+* @param - dev : icm20608设备
+*/
+static void icm20608_debugfs_init(struct icm20608_dev *dev)
+{
+    struct spi_device *spi = (struct spi_device *)dev->private_data;
+
+    if(IS_ERR_OR_NULL(icm20608_debugfs_root))
+        return;
+    dev->debugfs = debugfs_create_dir(dev_name(&spi->dev), icm20608_debugfs_root);
+    if(IS_ERR_OR_NULL(dev->debugfs))
+        return;
+    debugfs_create_file("stats", 0600, dev->debugfs, dev, &icm20608_stats_fops);
+}
+
+/*
+* @description : 获取片选GPIO, 优先使用设备自身节点中的cs-gpio属性,
+*                没有时由SPI控制器产生片选信号
+* @param - dev : icm20608设备
+* @param - spi : spi设备
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_cs_init(struct icm20608_dev *dev, struct spi_device *spi)
 {
     int ret = 0;
-    printk("icm20608_probe!\r\n");
+    struct device_node *parent;
 
-    /*注册字符设备驱动*/
-    icm20608dev.major = 0;   /*设置主设备号为0，确保让系统分配设备号*/
-    /*1、创建设备号*/
-    if(icm20608dev.major)         /*如果定义了设备号*/
-    {
-        icm20608dev.devid = MKDEV(icm20608dev.major, 0);
-        ret = register_chrdev_region(icm20608dev.devid, icm20608_CNT, icm20608_NAME);
+    dev->cs_gpio = of_get_named_gpio(dev->nd, "cs-gpio", 0);
+    if(!gpio_is_valid(dev->cs_gpio) && spi->chip_select == 0){
+        /*兼容旧设备树: cs-gpio写在ecspi控制器节点中, 只能用于0号片选*/
+        parent = of_get_parent(dev->nd);
+        dev->cs_gpio = of_get_named_gpio(parent, "cs-gpio", 0);
+        of_node_put(parent);
+        if(gpio_is_valid(dev->cs_gpio))
+            dev_warn(&spi->dev, "cs-gpio in controller node is deprecated\n");
     }
-    else                        /*如果没有定义设备号*/
-    {
-        ret = alloc_chrdev_region(&icm20608dev.devid, 0, icm20608_CNT, icm20608_NAME); /*申请设备号*/
-        icm20608dev.major = MAJOR(icm20608dev.devid);
-        icm20608dev.minor = MINOR(icm20608dev.devid);
+
+    if(!gpio_is_valid(dev->cs_gpio)){
+        dev->cs_gpio = -1;
+        printk("%s: use controller chip select %d\r\n", dev_name(&spi->dev), spi->chip_select);
+        return 0;
+    }
+    printk("%s: cs-gpio = %d\r\n", dev_name(&spi->dev), dev->cs_gpio);
+
+    /*申请cs并设置输出为高电平*/
+    ret = devm_gpio_request_one(&spi->dev, dev->cs_gpio, GPIOF_OUT_INIT_HIGH, dev_name(&spi->dev));
+    if(ret < 0){
+        printk("can't request cs-gpio!\r\n");
+        return ret;
+    }
+    return 0;
+}
+
+/*
+* @description : 初始化芯片并注册字符设备, 同步probe时在probe中调用,
+*                异步probe时在工作队列中调用
+* @param - dev : icm20608设备
+* @return : 0 成功，<0 失败
+*/
+static int icm20608_setup(struct icm20608_dev *dev)
+{
+    int ret = 0;
+    struct spi_device *spi = (struct spi_device *)dev->private_data;
+
+    /*初始化ICM20608内部寄存器*/
+    ret = icm20608reg_init(dev);
+    if(ret < 0)
+        return ret;
+
+    /*
+     * 设备树中有interrupts属性时使用数据就绪中断, 例如:
+     *     interrupt-parent = <&gpio1>;
+     *     interrupts = <1 IRQ_TYPE_EDGE_RISING>;
+     */
+    dev->irq = spi->irq;
+    if(dev->irq > 0){
+        ret = devm_request_threaded_irq(&spi->dev, dev->irq, icm20608_irq_handler,
+                                        icm20608_irq_thread, IRQF_TRIGGER_RISING | IRQF_ONESHOT,
+                                        dev_name(&spi->dev), dev);
+        if(ret < 0){
+            printk("irq %d request failed!\r\n", dev->irq);
+            return ret;
+        }
+        printk("%s: data ready irq = %d\r\n", dev_name(&spi->dev), dev->irq);
+    }else{
+        /*没有中断时由轮询线程按ODR周期采集*/
+        dev->poll_task = kthread_run(icm20608_poll_thread, dev, "%s", dev_name(&spi->dev));
+        if(IS_ERR(dev->poll_task)){
+            ret = PTR_ERR(dev->poll_task);
+            dev->poll_task = NULL;
+            return ret;
+        }
     }
+
+    /*1、分配次设备号, open通过次设备号找到设备*/
+    mutex_lock(&icm20608_idr_lock);
+    ret = idr_alloc(&icm20608_idr, dev, 0, icm20608_CNT, GFP_KERNEL);
+    mutex_unlock(&icm20608_idr_lock);
     if(ret < 0)
     {
         goto fail_devid;
     }
-    printk("icm20608dev major=%d, minor=%d\r\n", icm20608dev.major, icm20608dev.minor);
+    dev->major = MAJOR(icm20608_devt);
+    dev->minor = ret;
+    dev->devid = MKDEV(dev->major, dev->minor);
+    printk("icm20608dev major=%d, minor=%d\r\n", dev->major, dev->minor);
 
-    /*2初始话cdev*/
-    icm20608dev.cdev.owner = THIS_MODULE;
-    cdev_init(&icm20608dev.cdev, &icm20608_fops);
+    /*2、分配cdev, 打开的文件关闭时才释放, 不能嵌入在设备结构体中*/
+    dev->cdev = cdev_alloc();
+    if(!dev->cdev)
+    {
+        ret = -ENOMEM;
+        goto fail_cdev;
+    }
+    dev->cdev->owner = THIS_MODULE;
+    dev->cdev->ops = &icm20608_fops;
 
     /*3、添加一个cdev*/
-    ret = cdev_add(&icm20608dev.cdev, icm20608dev.devid, icm20608_CNT);
+    ret = cdev_add(dev->cdev, dev->devid, 1);
     if(ret < 0)
     {
+        kobject_put(&dev->cdev->kobj);
         goto fail_cdev;
     }
 
-    /*4、创建类*/
-    icm20608dev.class = class_create(THIS_MODULE, icm20608_NAME);
-    if(IS_ERR(icm20608dev.class))
+    /*4、创建设备, 设备名为icm20608-<次设备号>*/
+    dev->device = device_create_with_groups(icm20608_class, &spi->dev, dev->devid,
+                                            dev, icm20608_groups, "%s-%d", icm20608_NAME, dev->minor);
+    if(IS_ERR(dev->device))
     {
-        ret = PTR_ERR(icm20608dev.class);
-        goto fail_class;
-    }
-    /*5、创建设备*/
-    icm20608dev.device = device_create(icm20608dev.class, NULL, icm20608dev.devid, NULL, icm20608_NAME);
-    if(IS_ERR(icm20608dev.device))
-    {
-        ret = PTR_ERR(icm20608dev.device);
+        ret = PTR_ERR(dev->device);
         goto fail_device;
     }
 
-    /*获取设备树中的片选信号*/
-    icm20608dev.nd = of_find_node_by_path("/soc/aips-bus@02000000/spba-bus@02000000/ecspi@02010000");
-    if(icm20608dev.nd == NULL){
-        printk("ecsipi3 node not find!\r\n");
-        return -EINVAL;
-    }
+    icm20608_debugfs_init(dev);
+    smp_store_release(&dev->ready, true);  /*之前的初始化结果对读到ready的一方可见*/
 
-    icm20608dev.cs_gpio = of_get_named_gpio(icm20608dev.nd, "cs-gpio", 0);
-    if(icm20608dev.cs_gpio < 0){
-        printk("can't get cs-gpio!\r\n");
-        return -EINVAL;
-    }else{
-        printk("cs-gpio = %d\r\n",icm20608dev.cs_gpio);
-    }
+    printk("icm20608dev init()\r\n");
+    return 0;
 
-    /*设置cs输出为高电平*/
-    ret = gpio_direction_output(icm20608dev.cs_gpio, 1);
-    if(ret < 0){
-        printk("can't set cs-gpio!\r\n");
+fail_device:
+    cdev_del(dev->cdev);
+fail_cdev:
+    mutex_lock(&icm20608_idr_lock);
+    idr_remove(&icm20608_idr, dev->minor);
+    mutex_unlock(&icm20608_idr_lock);
+fail_devid:
+    if(dev->poll_task){
+        kthread_stop(dev->poll_task);
+        dev->poll_task = NULL;
     }
+    return ret;
+}
+
+/*异步probe: 复位等待等耗时的初始化放到工作队列中, 不阻塞启动过程*/
+static void icm20608_init_work(struct work_struct *work)
+{
+    int ret;
+    struct icm20608_dev *dev = container_of(work, struct icm20608_dev, init_work);
+    struct spi_device *spi = (struct spi_device *)dev->private_data;
+
+    ret = icm20608_setup(dev);
+    if(ret < 0)
+        dev_err(&spi->dev, "asynchronous init failed: %d\n", ret);
+}
+
+static int icm20608_probe(struct spi_device *spi)
+{
+    int ret = 0;
+    struct icm20608_dev *dev;
+    printk("icm20608_probe!\r\n");
+
+    /*
+     * 每个spi_device有自己的设备结构体, remove之后可能还有打开的文件,
+     * 不能用devm_kzalloc, 由引用计数在最后一个文件关闭时释放
+     */
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if(!dev)
+        return -ENOMEM;
+
+    kref_init(&dev->ref);
+    mutex_init(&dev->lock);
+    spin_lock_init(&dev->ring_lock);
+    spin_lock_init(&dev->stats.lock);
+    init_waitqueue_head(&dev->r_wait);
+    init_waitqueue_head(&dev->poll_wait);
+    INIT_WORK(&dev->init_work, icm20608_init_work);
+    dev->decim.factor = 1;                  /*默认不抽取*/
+    icm20608_check_decim(&dev->decim);
+    dev->nd = spi->dev.of_node;
+    dev->private_data = spi;                /*将数据保存在设备私有数据域中*/
+    spi_set_drvdata(spi, dev);
+
+    /*获取片选信号*/
+    ret = icm20608_cs_init(dev, spi);
+    if(ret < 0)
+        goto fail_free;
 
     /*初始化spi_device*/
     spi->mode = SPI_MODE_0;                 /*MODE0, CPOL=0, CPHA=0*/
-    spi_setup(spi);
-    icm20608dev.private_data = spi;         /*将数据保存在设备私有数据域中*/
+    ret = spi_setup(spi);
+    if(ret < 0)
+        goto fail_free;
 
-    /*初始化ICM20608内部寄存器*/
-    icm20608reg_init();
+    /*寄存器映射, 寄存器可在/sys/kernel/debug/regmap/<spi设备名>/registers中查看*/
+    dev->regmap = devm_regmap_init(&spi->dev, &icm20608_regmap_bus, dev, &icm20608_regmap_config);
+    if(IS_ERR(dev->regmap))
+    {
+        ret = PTR_ERR(dev->regmap);
+        goto fail_free;
+    }
 
-    printk("icm20608dev init()\r\n");
+    /*异步probe时/dev/icm20608-N在初始化完成后才出现*/
+    if(async_probe){
+        schedule_work(&dev->init_work);
+        return 0;
+    }
+    ret = icm20608_setup(dev);
+    if(ret < 0)
+        goto fail_free;
     return 0;
 
-fail_device:
-    class_destroy(icm20608dev.class);
-fail_class:
-    cdev_del(&icm20608dev.cdev);
-fail_cdev:
-    unregister_chrdev_region(icm20608dev.devid, icm20608_CNT);   
-fail_devid:
+fail_free:
+    kfree(dev);
     return ret;
 }
 
 static int icm20608_remove(struct spi_device *spi)
 {
-    /*注销设备驱动*/
-    cdev_del(&icm20608dev.cdev);
-    unregister_chrdev_region(icm20608dev.devid, icm20608_CNT);
-    device_destroy(icm20608dev.class, icm20608dev.devid);
-    class_destroy(icm20608dev.class);
+    struct icm20608_dev *dev = spi_get_drvdata(spi);
+
+    /*等待异步初始化结束, 初始化失败时没有需要注销的内容*/
+    flush_work(&dev->init_work);
+    if(!smp_load_acquire(&dev->ready))
+        goto out;
+
+    /*注销设备驱动, 之后的open找不到这个设备*/
+    mutex_lock(&icm20608_idr_lock);
+    idr_remove(&icm20608_idr, dev->minor);
+    mutex_unlock(&icm20608_idr_lock);
+    debugfs_remove_recursive(dev->debugfs);
+    device_destroy(icm20608_class, dev->devid);
+    cdev_del(dev->cdev);
+    if(dev->poll_task)
+        kthread_stop(dev->poll_task);
+
+    /*还打开着的文件不能再访问芯片, 阻塞的读者返回-ENODEV*/
+    mutex_lock(&dev->lock);
+    if(dev->users)
+        icm20608_stream_enable(dev, false);
+    dev->removed = true;
+    mutex_unlock(&dev->lock);
+    wake_up_interruptible(&dev->r_wait);
+    if(dev->irq > 0)
+        devm_free_irq(&spi->dev, dev->irq, dev);   /*等待中断线程结束, 设备结构体可能马上释放*/
 
     printk("icm20608_remove!\r\n");
+out:
+    kref_put(&dev->ref, icm20608_free);     /*没有打开的文件时在这里释放*/
     return 0;
 }
 
@@ -337,12 +1844,44 @@ static struct spi_driver icm20608_driver = {
 
 static int __init icm20608_init(void)
 {
-    return spi_register_driver(&icm20608_driver);
+    int ret = 0;
+
+    /*所有ICM20608共用一个主设备号和类, 每个设备一个次设备号*/
+    ret = alloc_chrdev_region(&icm20608_devt, 0, icm20608_CNT, icm20608_NAME);
+    if(ret < 0)
+        goto fail_devid;
+
+    icm20608_class = class_create(THIS_MODULE, icm20608_NAME);
+    if(IS_ERR(icm20608_class))
+    {
+        ret = PTR_ERR(icm20608_class);
+        goto fail_class;
+    }
+
+    /*debugfs创建失败时只是没有统计信息*/
+    icm20608_debugfs_root = debugfs_create_dir(icm20608_NAME, NULL);
+
+    ret = spi_register_driver(&icm20608_driver);
+    if(ret < 0)
+        goto fail_driver;
+    return 0;
+
+fail_driver:
+    debugfs_remove_recursive(icm20608_debugfs_root);
+    class_destroy(icm20608_class);
+fail_class:
+    unregister_chrdev_region(icm20608_devt, icm20608_CNT);
+fail_devid:
+    return ret;
 }
 
 static void __exit icm20608_exit(void)
 {
     spi_unregister_driver(&icm20608_driver);
+    idr_destroy(&icm20608_idr);
+    debugfs_remove_recursive(icm20608_debugfs_root);
+    class_destroy(icm20608_class);
+    unregister_chrdev_region(icm20608_devt, icm20608_CNT);
 }
 
 
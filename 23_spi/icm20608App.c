@@ -2,25 +2,44 @@
 #include "unistd.h"
 #include "sys/types.h"
 #include "sys/stat.h"
+#include "sys/ioctl.h"
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "icm20608ioctl.h"
 
+/*
+ * 使用方法: ./icm20608App /dev/icm20608-0 [calib] [decim=N]
+ * calib   : 先进行静止校准(芯片水平静止放置, Z轴朝上)
+ * decim=N : 驱动内部做N倍boxcar抽取滤波, 只读取抽取后的采样
+ */
+
+/*以x.xxx的形式打印千分之一单位的定点数*/
+static void print_milli(const char *name, int value, const char *unit)
+{
+	const char *sign = value < 0 ? "-" : "";
+
+	if(value < 0)
+		value = -value;
+	printf("%s = %s%d.%03d%s", name, sign, value / 1000, value % 1000, unit);
+}
 
 int main(int argc, char *argv[])
 {   
     int fd, err;
     char *filename;
-	signed int databuf[7];
-	signed int gyro_x_adc, gyro_y_adc, gyro_z_adc;
-	signed int accel_x_adc, accel_y_adc, accel_z_adc;
-	signed int temp_adc;
-
-	float gyro_x_act, gyro_y_act, gyro_z_act;
-	float accel_x_act, accel_y_act, accel_z_act;
-	float temp_act;
+	struct icm20608_si_sample samples[32];
+	struct icm20608_si_sample sample;
+	struct icm20608_calib calib;
+	struct icm20608_decim decim;
+	int i;
+	int format = ICM20608_FMT_SI;
+	long long last_print = 0;
+	int count = 0;
+	int dropped = 0;
+	int set_decim = 0;
 
-    if(argc != 2)
+    if(argc < 2 || argc > 4)
     {
         printf("Error param!\r\n");
         return -1;
@@ -34,38 +53,79 @@ int main(int argc, char *argv[])
         printf("file %s open failed!\r\n", argv[1]);
         return -1;
     }
-    
-    while (1) {
-		err = read(fd, databuf, sizeof(databuf));
-		if(err == 0) { 			/* 数据读取成功 */
-			gyro_x_adc = databuf[0];
-			gyro_y_adc = databuf[1];
-			gyro_z_adc = databuf[2];
-			accel_x_adc = databuf[3];
-			accel_y_adc = databuf[4];
-			accel_z_adc = databuf[5];
-			temp_adc = databuf[6];
 
-			/* 计算实际值 */
-			gyro_x_act = (float)(gyro_x_adc)  / 16.4;
-			gyro_y_act = (float)(gyro_y_adc)  / 16.4;
-			gyro_z_act = (float)(gyro_z_adc)  / 16.4;
-			accel_x_act = (float)(accel_x_adc) / 2048;
-			accel_y_act = (float)(accel_y_adc) / 2048;
-			accel_z_act = (float)(accel_z_adc) / 2048;
-			temp_act = ((float)(temp_adc) - 25 ) / 326.8 + 25;
+    /*静止校准*/
+    if(argc >= 3 && strcmp(argv[2], "calib") == 0)
+    {
+        memset(&calib, 0, sizeof(calib));
+        err = ioctl(fd, ICM20608_CALIBRATE, &calib);
+        if(err < 0)
+        {
+            printf("calibrate failed!\r\n");
+            close(fd);
+            return -1;
+        }
+        printf("gyro bias = %d %d %d, accel bias = %d %d %d\r\n",
+               calib.gyro_bias[0], calib.gyro_bias[1], calib.gyro_bias[2],
+               calib.accel_bias[0], calib.accel_bias[1], calib.accel_bias[2]);
+        printf("gyro offset = %d %d %d, accel offset = %d %d %d\r\n",
+               calib.offset.gyro[0], calib.offset.gyro[1], calib.offset.gyro[2],
+               calib.offset.accel[0], calib.offset.accel[1], calib.offset.accel[2]);
+    }
+
+    /*抽取滤波, 所有读者共用, 没有指定decim=N时保持驱动当前的设置*/
+    memset(&decim, 0, sizeof(decim));
+    for(i = 2; i < argc; i++)
+    {
+        if(strncmp(argv[i], "decim=", 6) == 0)
+        {
+            decim.factor = atoi(argv[i] + 6);
+            set_decim = 1;
+        }
+    }
+    if(set_decim)
+    {
+        err = ioctl(fd, ICM20608_SET_DECIM, &decim);
+        if(err < 0)
+        {
+            printf("set decimation failed!\r\n");
+            close(fd);
+            return -1;
+        }
+    }
 
+    /*由驱动换算为定点物理量, 应用程序不需要浮点运算*/
+    err = ioctl(fd, ICM20608_SET_FORMAT, &format);
+    if(err < 0)
+    {
+        printf("set format failed!\r\n");
+        close(fd);
+        return -1;
+    }
+    
+    /*阻塞读取, 每个采样只返回一次, 一次可读到多个采样; 多个进程打开时共享同一个采集流*/
+    while (1) {
+		err = read(fd, samples, sizeof(samples));
+		if(err < (int)sizeof(sample))
+			continue;
+		count += err / sizeof(sample);
+		sample = samples[err / sizeof(sample) - 1];
 
-			printf("\r\n原始值:\r\n");
-			printf("gx = %d, gy = %d, gz = %d\r\n", gyro_x_adc, gyro_y_adc, gyro_z_adc);
-			printf("ax = %d, ay = %d, az = %d\r\n", accel_x_adc, accel_y_adc, accel_z_adc);
-			printf("temp = %d\r\n", temp_adc);
-			printf("实际值:");
-			printf("act gx = %.2f°/S, act gy = %.2f°/S, act gz = %.2f°/S\r\n", gyro_x_act, gyro_y_act, gyro_z_act);
-			printf("act ax = %.2fg, act ay = %.2fg, act az = %.2fg\r\n", accel_x_act, accel_y_act, accel_z_act);
-			printf("act temp = %.2f°C\r\n", temp_act);
+		if(sample.timestamp - last_print >= 1000000000LL) { 	/* 每秒打印一次 */
+			last_print = sample.timestamp;
+			ioctl(fd, ICM20608_GET_DROPPED, &dropped);
+			printf("\r\n时间戳: %lld ns, 状态: %#x, 采样数: %d, 丢失: %d\r\n",
+				   (long long)sample.timestamp, sample.status, count, dropped);
+			count = 0;
+			printf("实际值:\r\n");
+			print_milli("act gx", sample.gyro[0], "°/S, ");
+			print_milli("act gy", sample.gyro[1], "°/S, ");
+			print_milli("act gz", sample.gyro[2], "°/S\r\n");
+			print_milli("act ax", sample.accel[0], "g, ");
+			print_milli("act ay", sample.accel[1], "g, ");
+			print_milli("act az", sample.accel[2], "g\r\n");
+			print_milli("act temp", sample.temp, "°C\r\n");
 		}
-		sleep(1); /*1s */
 	}
 
  
@@ -76,4 +136,4 @@ int main(int argc, char *argv[])
         return -1;
     }
     return 0;
-}
\ No newline at end of file
+}
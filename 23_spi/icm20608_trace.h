@@ -0,0 +1,72 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM icm20608
+
+#if !defined(_ICM20608_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ICM20608_TRACE_H
+
+/*
+ * ICM20608寄存器访问的tracepoint, 使用方法:
+ *     echo 1 > /sys/kernel/debug/tracing/events/icm20608/enable
+ *     cat /sys/kernel/debug/tracing/trace_pipe
+ */
+#include <linux/tracepoint.h>
+
+/*提交spi_message之前, write为1表示写寄存器*/
+TRACE_EVENT(icm20608_spi_submit,
+    TP_PROTO(const char *name, u8 reg, int len, bool write),
+    TP_ARGS(name, reg, len, write),
+
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(u8, reg)
+        __field(int, len)
+        __field(bool, write)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->reg = reg;
+        __entry->len = len;
+        __entry->write = write;
+    ),
+
+    TP_printk("%s %s reg=0x%02x len=%d", __get_str(name),
+              __entry->write ? "write" : "read", __entry->reg, __entry->len)
+);
+
+/*spi_sync返回之后, ns为从提交到完成的时间*/
+TRACE_EVENT(icm20608_spi_complete,
+    TP_PROTO(const char *name, u8 reg, int len, bool write, int ret, u64 ns),
+    TP_ARGS(name, reg, len, write, ret, ns),
+
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(u8, reg)
+        __field(int, len)
+        __field(bool, write)
+        __field(int, ret)
+        __field(u64, ns)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->reg = reg;
+        __entry->len = len;
+        __entry->write = write;
+        __entry->ret = ret;
+        __entry->ns = ns;
+    ),
+
+    TP_printk("%s %s reg=0x%02x len=%d ret=%d time=%lluns", __get_str(name),
+              __entry->write ? "write" : "read", __entry->reg, __entry->len,
+              __entry->ret, __entry->ns)
+);
+
+#endif /* _ICM20608_TRACE_H */
+
+/* 本文件不在include/trace/events下, 需要告诉define_trace.h它的位置 */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE icm20608_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,133 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "sys/ioctl.h"
+#include "sys/time.h"
+#include "sys/resource.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "icm20608ioctl.h"
+
+/*
+ * ICM20608吞吐量和丢数测试, 配合icm20608emu模拟器使用:
+ *     insmod icm20608.ko; insmod icm20608emu.ko [odr_hz=N] [use_irq=0]
+ *     ./icm20608benchApp /dev/icm20608-0 [秒数] [抽取倍数]
+ * 模拟器的陀螺仪X为0~16383循环的斜坡, 每个采样加1,
+ * 抽取后每个输出加抽取倍数, 斜坡不连续即说明有采样丢失
+ */
+
+#define RAMP_PERIOD     16384
+#define BATCH           64
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL +
+	       ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd, err, i, n;
+    int seconds = 10;
+    int format = ICM20608_FMT_SAMPLE;
+    int dropped = 0;
+    int have_prev = 0;
+    int prev = 0, step;
+    long long samples = 0, reads = 0, lost = 0, glitches = 0;
+    long long start, end, cpu_start, cpu_end;
+    struct icm20608_sample buf[BATCH];
+    struct icm20608_decim decim;
+    struct icm20608_config cfg;
+
+    if(argc < 2 || argc > 4)
+    {
+        printf("Error param!\r\n");
+        return -1;
+    }
+    if(argc >= 3)
+        seconds = atoi(argv[2]);
+
+    memset(&decim, 0, sizeof(decim));
+    decim.factor = argc == 4 ? atoi(argv[3]) : 1;
+
+    fd = open(argv[1], O_RDWR);
+    if(fd < 0)
+    {
+        printf("file %s open failed!\r\n", argv[1]);
+        return -1;
+    }
+
+    if(ioctl(fd, ICM20608_SET_FORMAT, &format) < 0 ||
+       ioctl(fd, ICM20608_SET_DECIM, &decim) < 0 ||
+       ioctl(fd, ICM20608_GET_CONFIG, &cfg) < 0)
+    {
+        printf("configure failed!\r\n");
+        close(fd);
+        return -1;
+    }
+    printf("odr = %uHz, decimation = %u, expected %u samples/s\r\n",
+           cfg.odr_hz, decim.factor, cfg.odr_hz / decim.factor);
+
+    start = now_ns();
+    cpu_start = cpu_us();
+    end = start + seconds * 1000000000LL;
+    while(now_ns() < end)
+    {
+        err = read(fd, buf, sizeof(buf));
+        if(err < 0)
+        {
+            printf("read failed!\r\n");
+            break;
+        }
+        reads++;
+        n = err / sizeof(buf[0]);
+        for(i = 0; i < n; i++)
+        {
+            /*斜坡回绕附近的抽取输出是跨回绕点的平均值, 不做检查*/
+            if(have_prev && prev < RAMP_PERIOD - 2 * (int)decim.factor &&
+               buf[i].gyro[0] >= 2 * (int)decim.factor)
+            {
+                step = buf[i].gyro[0] - prev;
+                if(step > (int)decim.factor + (int)decim.factor / 2)
+                    lost += (step + decim.factor / 2) / decim.factor - 1;
+                else if(step < (int)decim.factor / 2)
+                    glitches++;
+            }
+            prev = buf[i].gyro[0];
+            have_prev = 1;
+        }
+        samples += n;
+    }
+    cpu_end = cpu_us();
+    end = now_ns();
+    ioctl(fd, ICM20608_GET_DROPPED, &dropped);
+
+    printf("%lld samples in %lld reads, %lld.%03lld s\r\n", samples, reads,
+           (end - start) / 1000000000LL, (end - start) / 1000000LL % 1000);
+    printf("rate = %lld samples/s, %lld bytes/s, %lld samples/read\r\n",
+           samples * 1000000000LL / (end - start),
+           samples * (long long)sizeof(buf[0]) * 1000000000LL / (end - start),
+           reads ? samples / reads : 0);
+    printf("lost = %lld (ramp gaps), dropped = %d (ring overrun), glitches = %lld\r\n",
+           lost, dropped, glitches);
+    printf("cpu = %lld us (%lld.%02lld%%)\r\n", cpu_end - cpu_start,
+           (cpu_end - cpu_start) * 100000LL / (end - start),
+           (cpu_end - cpu_start) * 10000000LL / (end - start) % 100);
+
+    close(fd);
+    return 0;
+}
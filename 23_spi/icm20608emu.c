@@ -0,0 +1,447 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/irq.h>
+#include <linux/interrupt.h>
+#include <linux/platform_device.h>
+#include <linux/spi/spi.h>
+
+#include "icm20608reg.h"
+
+/*
+ * ICM20608寄存器模型, 用来在没有开发板时测试icm20608驱动的吞吐量和丢数:
+ * 注册一个软件SPI控制器, 在上面挂一个modalias为"alk,icm20608"的spi_device,
+ * 未修改的icm20608驱动即可在x86或QEMU内核上probe。
+ *
+ * 模拟的内容:
+ *   WHO_AM_I、复位、数据寄存器、INT_STATUS、INT_ENABLE、FIFO_EN、
+ *   USER_CTRL(FIFO使能/复位)、FIFO_COUNTH/L、FIFO_R_W, 其余寄存器只做读写存储
+ *   hrtimer按ODR产生采样, 可选用一个软件中断号模拟数据就绪中断
+ *
+ * 合成波形: 陀螺仪X为0~16383循环的斜坡(每个采样加1), 陀螺仪Y为斜坡的高位,
+ * 加速度计Z为1g, 其余为0, 应用程序检查斜坡是否连续即可发现丢数
+ */
+
+#define EMU_NAME            "icm20608emu"
+#define EMU_NREGS           128
+#define EMU_FIFO_SIZE       512         /* 与芯片相同的512字节FIFO */
+#define EMU_RAMP_PERIOD     16384       /* 斜坡周期 */
+
+#define EMU_PWR1_RESET      0x80        /* PWR_MGMT_1: 复位 */
+#define EMU_PWR1_DEFAULT    0x40        /* PWR_MGMT_1复位值: 睡眠 */
+#define EMU_USER_FIFO_EN    0x40        /* USER_CTRL: 打开FIFO */
+#define EMU_USER_FIFO_RST   0x04        /* USER_CTRL: 复位FIFO */
+#define EMU_INT_ANYRD_2CLEAR 0x10       /* INT_PIN_CFG: 任意读操作清除中断 */
+#define EMU_INT_DATA_RDY    0x01        /* INT_STATUS/INT_ENABLE: 数据就绪 */
+#define EMU_INT_FIFO_OFLOW  0x10        /* INT_STATUS/INT_ENABLE: FIFO溢出 */
+
+/*0表示按SMPLRT_DIV和CONFIG寄存器计算ODR, 与真实芯片相同*/
+static unsigned int odr_hz;
+module_param(odr_hz, uint, 0444);
+MODULE_PARM_DESC(odr_hz, "force the sample rate in Hz, 0 follows SMPLRT_DIV/CONFIG");
+
+/*1表示提供数据就绪中断, 0表示没有中断, 驱动使用轮询线程*/
+static bool use_irq = true;
+module_param(use_irq, bool, 0444);
+MODULE_PARM_DESC(use_irq, "provide an emulated data-ready interrupt");
+
+/*芯片ID, 0xAF为ICM20608G, 0xAE为ICM20608D*/
+static unsigned int whoami = ICM20608G_ID;
+module_param(whoami, uint, 0444);
+MODULE_PARM_DESC(whoami, "value returned by WHO_AM_I");
+
+/*模拟器状态*/
+struct icm20608emu_dev {
+    struct spi_master *master;  /* 软件SPI控制器 */
+    struct spi_device *spi;     /* 挂在控制器上的ICM20608 */
+    struct hrtimer timer;       /* 按ODR产生采样 */
+    int irq;                    /* 模拟的数据就绪中断号, <=0表示没有 */
+
+    spinlock_t lock;            /* 保护以下寄存器状态, 定时器中断中也会访问 */
+    u8 regs[EMU_NREGS];         /* 寄存器 */
+    u8 fifo[EMU_FIFO_SIZE];     /* FIFO环形缓冲区 */
+    unsigned int fifo_head;     /* 下一个写入位置 */
+    unsigned int fifo_count;    /* FIFO中的字节数 */
+    u32 index;                  /* 已产生的采样个数, 用于生成斜坡 */
+    u64 fifo_overflows;         /* FIFO溢出次数 */
+};
+
+static void icm20608emu_reset(struct icm20608emu_dev *emu)
+{
+    memset(emu->regs, 0, sizeof(emu->regs));
+    emu->regs[ICM20_PWR_MGMT_1] = EMU_PWR1_DEFAULT;
+    emu->regs[ICM20_WHO_AM_I] = whoami;
+    emu->fifo_head = 0;
+    emu->fifo_count = 0;
+}
+
+/*
+* @description : 按寄存器配置计算采样周期, 与驱动中的icm20608_fill_config一致
+*/
+static u64 icm20608emu_period_ns(struct icm20608emu_dev *emu)
+{
+    unsigned int dlpf = emu->regs[ICM20_CONFIG] & 0x07;
+    unsigned int odr;
+
+    if(odr_hz)
+        odr = odr_hz;
+    else if(dlpf == 0 || dlpf == 7)
+        odr = 8000;
+    else
+        odr = 1000 / (1 + emu->regs[ICM20_SMPLRT_DIV]);
+    return div_u64(NSEC_PER_SEC, odr);
+}
+
+static void icm20608emu_put16(u8 *p, s16 v)
+{
+    p[0] = (u16)v >> 8;
+    p[1] = (u16)v & 0xFF;
+}
+
+static void icm20608emu_fifo_push(struct icm20608emu_dev *emu, const u8 *data, int len)
+{
+    int i;
+
+    for(i = 0; i < len; i++){
+        if(emu->fifo_count == EMU_FIFO_SIZE){
+            /*FIFO满时丢弃最旧的数据, 与芯片默认行为相同*/
+            emu->fifo_count--;
+            emu->regs[ICM20_INT_STATUS] |= EMU_INT_FIFO_OFLOW;
+            emu->fifo_overflows++;
+        }
+        emu->fifo[emu->fifo_head] = data[i];
+        emu->fifo_head = (emu->fifo_head + 1) % EMU_FIFO_SIZE;
+        emu->fifo_count++;
+    }
+}
+
+static u8 icm20608emu_fifo_pop(struct icm20608emu_dev *emu)
+{
+    unsigned int tail;
+
+    if(emu->fifo_count == 0)
+        return 0xFF;
+    tail = (emu->fifo_head + EMU_FIFO_SIZE - emu->fifo_count) % EMU_FIFO_SIZE;
+    emu->fifo_count--;
+    return emu->fifo[tail];
+}
+
+/*
+* @description : 产生一个采样, 更新数据寄存器, FIFO打开时写入FIFO,
+*                调用者需持有emu->lock
+* @return : true 需要产生数据就绪中断
+*/
+static bool icm20608emu_sample(struct icm20608emu_dev *emu)
+{
+    u8 *out = &emu->regs[ICM20_ACCEL_XOUT_H];
+    u8 fifo_en = emu->regs[ICM20_FIFO_EN];
+    u32 ramp = emu->index % EMU_RAMP_PERIOD;
+
+    /*寄存器顺序: 加速度计XYZ、温度、陀螺仪XYZ*/
+    icm20608emu_put16(&out[0], 0);
+    icm20608emu_put16(&out[2], 0);
+    icm20608emu_put16(&out[4], 16384 >> ((emu->regs[ICM20_ACCEL_CONFIG] >> 3) & 0x03));
+    icm20608emu_put16(&out[6], 0);                  /* 25°C */
+    icm20608emu_put16(&out[8], ramp);
+    icm20608emu_put16(&out[10], (emu->index / EMU_RAMP_PERIOD) & 0x7FFF);
+    icm20608emu_put16(&out[12], 0);
+    emu->index++;
+
+    /*FIFO中的顺序与寄存器相同, 按FIFO_EN选择通道*/
+    if(emu->regs[ICM20_USER_CTRL] & EMU_USER_FIFO_EN){
+        if(fifo_en & 0x08)
+            icm20608emu_fifo_push(emu, &out[0], 6);
+        if(fifo_en & 0x80)
+            icm20608emu_fifo_push(emu, &out[6], 2);
+        if(fifo_en & 0x40)
+            icm20608emu_fifo_push(emu, &out[8], 2);
+        if(fifo_en & 0x20)
+            icm20608emu_fifo_push(emu, &out[10], 2);
+        if(fifo_en & 0x10)
+            icm20608emu_fifo_push(emu, &out[12], 2);
+    }
+
+    emu->regs[ICM20_INT_STATUS] |= EMU_INT_DATA_RDY;
+    return (emu->regs[ICM20_INT_ENABLE] & emu->regs[ICM20_INT_STATUS]) != 0;
+}
+
+static enum hrtimer_restart icm20608emu_timer_func(struct hrtimer *timer)
+{
+    bool fire = false;
+    u64 period;
+    unsigned long flags;
+    struct icm20608emu_dev *emu = container_of(timer, struct icm20608emu_dev, timer);
+
+    spin_lock_irqsave(&emu->lock, flags);
+    if(!(emu->regs[ICM20_PWR_MGMT_1] & EMU_PWR1_DEFAULT))     /*睡眠时不采样*/
+        fire = icm20608emu_sample(emu);
+    period = icm20608emu_period_ns(emu);
+    spin_unlock_irqrestore(&emu->lock, flags);
+
+    if(fire && emu->irq > 0)
+        generic_handle_irq(emu->irq);
+
+    hrtimer_forward_now(timer, ns_to_ktime(period));
+    return HRTIMER_RESTART;
+}
+
+/*
+* @description : 读一个寄存器, FIFO_R_W每次读取弹出一个字节, 调用者需持有emu->lock
+*/
+static u8 icm20608emu_read_reg(struct icm20608emu_dev *emu, u8 reg)
+{
+    u8 val;
+
+    switch(reg){
+        case ICM20_FIFO_COUNTH:
+            return emu->fifo_count >> 8;
+        case ICM20_FIFO_COUNTL:
+            return emu->fifo_count & 0xFF;
+        case ICM20_FIFO_R_W:
+            return icm20608emu_fifo_pop(emu);
+        case ICM20_INT_STATUS:
+            val = emu->regs[reg];
+            emu->regs[reg] = 0;         /* 读清除 */
+            return val;
+        default:
+            if(emu->regs[ICM20_INT_PIN_CFG] & EMU_INT_ANYRD_2CLEAR)
+                emu->regs[ICM20_INT_STATUS] = 0;
+            return emu->regs[reg];
+    }
+}
+
+/*
+* @description : 写一个寄存器, 调用者需持有emu->lock
+*/
+static void icm20608emu_write_reg(struct icm20608emu_dev *emu, u8 reg, u8 val)
+{
+    switch(reg){
+        case ICM20_PWR_MGMT_1:
+            if(val & EMU_PWR1_RESET){
+                icm20608emu_reset(emu);
+                return;
+            }
+            break;
+        case ICM20_USER_CTRL:
+            if(val & EMU_USER_FIFO_RST){
+                emu->fifo_head = 0;
+                emu->fifo_count = 0;
+                val &= ~EMU_USER_FIFO_RST;  /* 自动清零 */
+            }
+            break;
+        case ICM20_WHO_AM_I:
+        case ICM20_INT_STATUS:
+        case ICM20_FIFO_COUNTH:
+        case ICM20_FIFO_COUNTL:
+            return;                         /* 只读 */
+        case ICM20_FIFO_R_W:
+            icm20608emu_fifo_push(emu, &val, 1);
+            return;
+        default:
+            if(reg >= ICM20_ACCEL_XOUT_H && reg <= ICM20_GYRO_ZOUT_L)
+                return;                     /* 数据寄存器只读 */
+            break;
+    }
+    emu->regs[reg] = val;
+}
+
+/*
+* @description : 处理一个spi_message, 第一个字节为寄存器地址, bit7为1表示读,
+*                之后的字节在同一个message中可以分布在多个spi_transfer里,
+*                地址自动递增(FIFO_R_W除外)
+*/
+static int icm20608emu_transfer_one_message(struct spi_master *master, struct spi_message *msg)
+{
+    int i;
+    u8 reg = 0;
+    bool read = false, first = true;
+    unsigned long flags;
+    struct spi_transfer *t;
+    struct icm20608emu_dev *emu = spi_master_get_devdata(master);
+
+    spin_lock_irqsave(&emu->lock, flags);
+    list_for_each_entry(t, &msg->transfers, transfer_list){
+        const u8 *tx = t->tx_buf;
+        u8 *rx = t->rx_buf;
+
+        for(i = 0; i < t->len; i++){
+            u8 out = 0xFF;
+
+            if(first){
+                read = tx && (tx[i] & 0x80);
+                reg = tx ? (tx[i] & 0x7F) : 0;
+                first = false;
+            }else if(read){
+                out = icm20608emu_read_reg(emu, reg);
+                if(reg != ICM20_FIFO_R_W)
+                    reg = (reg + 1) & (EMU_NREGS - 1);
+            }else if(tx){
+                icm20608emu_write_reg(emu, reg, tx[i]);
+                if(reg != ICM20_FIFO_R_W)
+                    reg = (reg + 1) & (EMU_NREGS - 1);
+            }
+            if(rx)
+                rx[i] = out;
+        }
+        msg->actual_length += t->len;
+    }
+    spin_unlock_irqrestore(&emu->lock, flags);
+
+    msg->status = 0;
+    spi_finalize_current_message(master);
+    return 0;
+}
+
+/*
+* @description : 分配一个软件中断号作为数据就绪中断
+* @return : 中断号, <0 失败
+*/
+static int icm20608emu_irq_alloc(void)
+{
+    int irq = irq_alloc_desc(0);
+
+    if(irq < 0)
+        return irq;
+    irq_set_chip_and_handler(irq, &dummy_irq_chip, handle_simple_irq);
+    irq_modify_status(irq, IRQ_NOREQUEST | IRQ_NOPROBE, 0);
+    return irq;
+}
+
+static int icm20608emu_probe(struct platform_device *pdev)
+{
+    int ret;
+    struct spi_master *master;
+    struct icm20608emu_dev *emu;
+    struct spi_board_info info = {
+        .modalias = "alk,icm20608",
+        .max_speed_hz = 8000000,
+        .chip_select = 0,
+        .mode = SPI_MODE_0,
+    };
+
+    master = spi_alloc_master(&pdev->dev, sizeof(*emu));
+    if(!master)
+        return -ENOMEM;
+
+    emu = spi_master_get_devdata(master);
+    emu->master = master;
+    spin_lock_init(&emu->lock);
+    icm20608emu_reset(emu);
+    platform_set_drvdata(pdev, emu);
+
+    master->bus_num = -1;               /* 动态分配总线号 */
+    master->num_chipselect = 1;
+    master->mode_bits = SPI_CPOL | SPI_CPHA;
+    master->transfer_one_message = icm20608emu_transfer_one_message;
+
+    emu->irq = -1;
+    if(use_irq){
+        emu->irq = icm20608emu_irq_alloc();
+        if(emu->irq < 0){
+            ret = emu->irq;
+            goto fail_irq;
+        }
+    }
+
+    hrtimer_init(&emu->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    emu->timer.function = icm20608emu_timer_func;
+    hrtimer_start(&emu->timer, ns_to_ktime(icm20608emu_period_ns(emu)), HRTIMER_MODE_REL);
+
+    ret = spi_register_master(master);
+    if(ret < 0)
+        goto fail_master;
+
+    /*挂上ICM20608, icm20608驱动已加载时会立即probe*/
+    info.irq = emu->irq > 0 ? emu->irq : 0;
+    emu->spi = spi_new_device(master, &info);
+    if(!emu->spi){
+        ret = -ENODEV;
+        goto fail_device;
+    }
+
+    printk("%s: spi%d, irq = %d\r\n", EMU_NAME, master->bus_num, emu->irq);
+    return 0;
+
+fail_device:
+    spi_unregister_master(master);
+    hrtimer_cancel(&emu->timer);
+    if(emu->irq > 0)
+        irq_free_desc(emu->irq);
+    return ret;                         /* spi_unregister_master已释放master */
+fail_master:
+    hrtimer_cancel(&emu->timer);
+    if(emu->irq > 0)
+        irq_free_desc(emu->irq);
+fail_irq:
+    spi_master_put(master);
+    return ret;
+}
+
+static int icm20608emu_remove(struct platform_device *pdev)
+{
+    struct icm20608emu_dev *emu = platform_get_drvdata(pdev);
+    int irq = emu->irq;
+
+    printk("%s: %llu fifo overflows\r\n", EMU_NAME, emu->fifo_overflows);
+
+    /*先注销spi_device, icm20608驱动会释放中断*/
+    spi_unregister_device(emu->spi);
+    hrtimer_cancel(&emu->timer);
+    spi_unregister_master(emu->master);     /* 之后emu已被释放 */
+    if(irq > 0)
+        irq_free_desc(irq);
+    return 0;
+}
+
+static void icm20608emu_release(struct device *dev)
+{
+}
+
+/*platform设备, 作为软件SPI控制器的父设备*/
+static struct platform_device icm20608emu_device = {
+    .name = EMU_NAME,
+    .id = -1,
+    .dev = {
+        .release = icm20608emu_release,
+    },
+};
+
+static struct platform_driver icm20608emu_driver = {
+    .probe = icm20608emu_probe,
+    .remove = icm20608emu_remove,
+    .driver = {
+        .name = EMU_NAME,
+        .owner = THIS_MODULE,
+    },
+};
+
+static int __init icm20608emu_init(void)
+{
+    int ret;
+
+    ret = platform_driver_register(&icm20608emu_driver);
+    if(ret < 0)
+        return ret;
+
+    ret = platform_device_register(&icm20608emu_device);
+    if(ret < 0)
+        platform_driver_unregister(&icm20608emu_driver);
+    return ret;
+}
+
+static void __exit icm20608emu_exit(void)
+{
+    platform_device_unregister(&icm20608emu_device);
+    platform_driver_unregister(&icm20608emu_driver);
+}
+
+module_init(icm20608emu_init);
+module_exit(icm20608emu_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("mankc");
@@ -0,0 +1,128 @@
+#ifndef _ICM20608IOCTL_H
+#define _ICM20608IOCTL_H
+
+/*
+ * ICM20608驱动与应用程序共用的数据格式和ioctl命令
+ */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* 采样数据格式版本号 */
+#define ICM20608_SAMPLE_VERSION     1
+
+/* read()返回的数据格式 */
+#define ICM20608_FMT_LEGACY         0       /* 旧格式: signed int data[7], read返回0 */
+#define ICM20608_FMT_SAMPLE         1       /* 紧凑格式: struct icm20608_sample */
+#define ICM20608_FMT_SI             2       /* 定点物理量格式: struct icm20608_si_sample */
+
+/* status字节, 取自INT_STATUS寄存器 */
+#define ICM20608_STATUS_DATA_RDY    0x01    /* 数据就绪 */
+
+/*
+ * 紧凑采样格式, 共24字节
+ * timestamp : 数据就绪时刻的ktime(CLOCK_MONOTONIC, 单位ns)
+ * gyro/accel/temp : 原始值, 顺序与旧格式相同
+ */
+struct icm20608_sample {
+    __s64 timestamp;
+    __s16 gyro[3];      /* 陀螺仪 X/Y/Z 原始值 */
+    __s16 accel[3];     /* 加速度计 X/Y/Z 原始值 */
+    __s16 temp;         /* 温度原始值 */
+    __u8  version;      /* ICM20608_SAMPLE_VERSION */
+    __u8  status;       /* INT_STATUS */
+} __attribute__((packed));
+
+/*
+ * 定点物理量采样格式, 共40字节, 由驱动按当前量程换算, 应用程序无需浮点运算
+ */
+struct icm20608_si_sample {
+    __s64 timestamp;
+    __s32 gyro[3];      /* 角速度, 单位m°/s */
+    __s32 accel[3];     /* 加速度, 单位mg */
+    __s32 temp;         /* 温度, 单位m°C */
+    __u8  version;      /* ICM20608_SAMPLE_VERSION */
+    __u8  status;       /* INT_STATUS */
+    __u8  reserved[2];
+} __attribute__((packed));
+
+/* 陀螺仪量程, GYRO_CONFIG[4:3] */
+#define ICM20608_GYRO_FS_250DPS     0
+#define ICM20608_GYRO_FS_500DPS     1
+#define ICM20608_GYRO_FS_1000DPS    2
+#define ICM20608_GYRO_FS_2000DPS    3
+
+/* 加速度计量程, ACCEL_CONFIG[4:3] */
+#define ICM20608_ACCEL_FS_2G        0
+#define ICM20608_ACCEL_FS_4G        1
+#define ICM20608_ACCEL_FS_8G        2
+#define ICM20608_ACCEL_FS_16G       3
+
+/*
+ * 采样配置
+ * ICM20608_SET_CONFIG设置前5项, 驱动在返回时填入实际生效的速率和灵敏度
+ * gyro_dlpf为0或7时内部采样率为8KHz且smplrt_div无效, 否则ODR = 1KHz/(1+smplrt_div)
+ */
+struct icm20608_config {
+    __u8  smplrt_div;       /* 采样率分频 */
+    __u8  gyro_fs;          /* ICM20608_GYRO_FS_xxx */
+    __u8  accel_fs;         /* ICM20608_ACCEL_FS_xxx */
+    __u8  gyro_dlpf;        /* 陀螺仪低通滤波 CONFIG[2:0], 0~7 */
+    __u8  accel_dlpf;       /* 加速度计低通滤波 ACCEL_CONFIG2[2:0], 0~7 */
+    __u8  reserved[3];
+    __u32 odr_hz;           /* 输出数据速率, 单位Hz */
+    __u32 gyro_sens_x10;    /* 陀螺仪灵敏度, 单位0.1LSB/(°/s), 如164表示16.4 */
+    __u32 accel_sens;       /* 加速度计灵敏度, 单位LSB/g */
+    __u32 temp_sens_x10;    /* 温度灵敏度, 单位0.1LSB/°C */
+};
+
+/*
+ * 偏移寄存器的值
+ * gyro : XG/YG/ZG_OFFS_USR, 偏移量(LSB) = gyro * 4 / 2^gyro_fs
+ * accel: XA/YA/ZA_OFFSET[14:0], 单位0.98mg, 上电时为出厂校准值
+ */
+struct icm20608_offset {
+    __s16 gyro[3];
+    __s16 accel[3];
+};
+
+/*
+ * 静止校准, 校准时芯片需水平静止放置且Z轴朝上
+ * samples为求平均的采样次数, 0表示使用默认值;
+ * 驱动返回测得的零偏(当前量程下的原始值)和最终写入的偏移寄存器值
+ */
+struct icm20608_calib {
+    __u32 samples;
+    __s32 gyro_bias[3];
+    __s32 accel_bias[3];
+    struct icm20608_offset offset;
+};
+
+/*
+ * 抽取滤波配置, 驱动在采样进入共享缓冲区之前完成滤波和抽取
+ * factor : 抽取倍数1~32, 1表示不抽取, 输出速率 = odr_hz / factor
+ * ntaps  : FIR系数个数, 0表示使用长度为factor的滑动平均(boxcar), factor为1时0表示不滤波
+ * coeffs : Q15格式的FIR系数, coeffs[0]乘以最新的输入, 系数绝对值之和需小于65536
+ */
+#define ICM20608_DECIM_MAX_FACTOR   32
+#define ICM20608_DECIM_MAX_TAPS     32
+
+struct icm20608_decim {
+    __u32 factor;
+    __u32 ntaps;
+    __s16 coeffs[ICM20608_DECIM_MAX_TAPS];
+};
+
+/* ioctl命令 */
+#define ICM20608_SET_FORMAT     _IOW(0xEE, 1, int)
+#define ICM20608_GET_FORMAT     _IOR(0xEE, 2, int)
+#define ICM20608_SET_CONFIG     _IOWR(0xEE, 3, struct icm20608_config)
+#define ICM20608_GET_CONFIG     _IOR(0xEE, 4, struct icm20608_config)
+#define ICM20608_CALIBRATE      _IOWR(0xEE, 5, struct icm20608_calib)
+#define ICM20608_GET_OFFSET     _IOR(0xEE, 6, struct icm20608_offset)
+#define ICM20608_SET_OFFSET     _IOW(0xEE, 7, struct icm20608_offset)
+#define ICM20608_RESET_OFFSET   _IO(0xEE, 8)    /* 恢复出厂偏移 */
+#define ICM20608_GET_DROPPED    _IOR(0xEE, 9, int)  /* 本文件读得太慢被覆盖的采样个数 */
+#define ICM20608_SET_DECIM      _IOW(0xEE, 10, struct icm20608_decim)
+#define ICM20608_GET_DECIM      _IOR(0xEE, 11, struct icm20608_decim)
+
+#endif // !_ICM20608IOCTL_H
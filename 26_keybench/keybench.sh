@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# 依次加载各个按键驱动, 用keybenchApp测量边沿到应用程序的延迟, 输出对比表:
+#     insmod keyemu.ko
+#     ./keybench.sh [模块目录] [边沿个数]
+# 设备树中的key节点需要使用keyemu的引脚, 见keyemu.c。
+# 每个驱动测试前把debounce_us设为0, 只比较通知方式本身的延迟
+#
+
+DIR=${1:-.}
+COUNT=${2:-1000}
+APP=${APP:-./keybenchApp}
+
+# 模块 方式 设备 名称
+TESTS="
+keyirq.ko       read    /dev/keyirq     keyirq
+tasklet.ko      read    /dev/keyirq     tasklet
+work.ko         read    /dev/keyirq     work
+threadirq.ko    read    /dev/keyirq     threadirq
+blockio.ko      block   /dev/blockio    blockio
+noblockio.ko    poll    /dev/noblockio  noblockio
+noblockio.ko    ring    /dev/noblockio  noblockio-mmap
+asyncnotice.ko  sigio   /dev/keyirq     asyncnotice
+keyinput.ko     input   -               keyinput
+"
+
+if [ ! -e /dev/keyemu ]; then
+    echo "/dev/keyemu not found, insmod keyemu.ko first!"
+    exit 1
+fi
+
+# 找到名为keyinput的输入设备, 打印它的sysfs目录
+find_input()
+{
+    for d in /sys/class/input/input*; do
+        if [ "$(cat $d/name 2>/dev/null)" = "keyinput" ]; then
+            echo $d
+            return
+        fi
+    done
+}
+
+run()
+{
+    ko=$1; mode=$2; dev=$3; name=$4
+
+    if [ ! -e $DIR/$ko ]; then
+        echo "$name: $DIR/$ko not found"
+        return
+    fi
+    insmod $DIR/$ko || return
+
+    # 等待mdev创建设备节点
+    sleep 1
+    if [ "$mode" = "input" ]; then
+        sysdir=$(find_input)
+        dev=/dev/input/$(basename $(ls -d $sysdir/event* | head -n 1))
+    else
+        node=$(basename $dev)
+        sysdir=/sys/class/$node/$node
+    fi
+
+    echo 0 > $sysdir/debounce_us
+    $APP $mode $dev $COUNT $name
+    rmmod ${ko%.ko}
+}
+
+$APP -H
+echo "$TESTS" | while read ko mode dev name; do
+    [ -n "$ko" ] && run $ko $mode $dev $name
+done
@@ -0,0 +1,340 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "sys/time.h"
+#include "sys/resource.h"
+#include "sys/mman.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "errno.h"
+#include "poll.h"
+#include "signal.h"
+#include <linux/input.h>
+#include "keyevent.h"
+
+/*
+ * 按键边沿到应用程序收到事件的延迟测试, 配合keyemu模拟器使用:
+ *     ./keybenchApp <方式> <设备> [边沿个数] [名称]
+ *     ./keybenchApp -H                      只打印表头
+ * 方式:
+ *     read    非阻塞read()忙等, 14_keyint的keyirq/tasklet/work/threadirq
+ *     block   阻塞read(), 15_blockio
+ *     poll    poll()后read(), 16_noblockio
+ *     sigio   SIGIO通知后read(), 17_asyncnotice, 用sigtimedwait等待信号
+ *     input   阻塞读取input_event, 21_keyinput
+ *     ring    读取mmap的环形缓冲区, 为空时poll(), 16_noblockio
+ * 通过/dev/keyemu交替按下和松开0号引脚, 延迟从写入之前算起, 到read()返回为止,
+ * 包含驱动的消抖时间, 测试前把debounce_us设为0(见keybench.sh)。
+ * CPU一栏为每个边沿消耗的CPU时间, app为本进程(含系统调用),
+ * sys为/proc/stat中整个系统的非空闲时间, 包含中断、下半部和内核线程, 精度为一个时钟节拍
+ */
+
+#define EMU_DEV         "/dev/keyemu"
+#define EMU_LINE        0
+#define EDGE_GAP_US     2000        /*两个边沿之间的间隔, 让上一个事件处理完*/
+#define EVENT_TIMEOUT_MS 1000       /*超过这个时间没有收到事件算作丢失*/
+#define EVENT_BATCH     16
+
+enum bench_mode {
+    MODE_READ,
+    MODE_BLOCK,
+    MODE_POLL,
+    MODE_SIGIO,
+    MODE_INPUT,
+    MODE_RING,
+};
+
+static const char *mode_names[] = { "read", "block", "poll", "sigio", "input", "ring" };
+
+static struct key_ring *ring;   /*ring方式时映射的环形缓冲区*/
+
+/*取出环形缓冲区中所有未读的事件, 返回取出的个数*/
+static int ring_consume(void)
+{
+    unsigned int tail = ring->tail;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+    return head - tail;
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long cpu_us(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*整个系统的非空闲时间, 单位us, 读取失败返回-1*/
+static long long sys_busy_us(void)
+{
+    FILE *fp;
+    unsigned long long user, nice, system, idle, iowait, irq, softirq;
+    int n;
+
+    fp = fopen("/proc/stat", "r");
+    if(!fp)
+        return -1;
+    n = fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu",
+               &user, &nice, &system, &idle, &iowait, &irq, &softirq);
+    fclose(fp);
+    if(n != 7)
+        return -1;
+    return (long long)(user + nice + system + irq + softirq) * 1000000LL / sysconf(_SC_CLK_TCK);
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void alarm_func(int signum)
+{
+    (void)signum;       /*只用来打断阻塞的read()*/
+}
+
+/*
+ * 等待一个按键事件, 一次read()读到多个事件时也只算一个,
+ * 返回0收到事件, -1超时或出错
+ */
+static int wait_event(int fd, enum bench_mode mode)
+{
+    int ret;
+    long long deadline;
+    struct pollfd pfd;
+    struct timespec ts;
+    sigset_t set;
+    struct key_event events[EVENT_BATCH];
+    struct input_event ie;
+
+    switch(mode){
+        case MODE_READ:
+            /*驱动没有事件时返回EAGAIN, 一直重试*/
+            deadline = now_ns() + EVENT_TIMEOUT_MS * 1000000LL;
+            while(now_ns() < deadline){
+                if(read(fd, events, sizeof(events)) > 0)
+                    return 0;
+            }
+            return -1;
+
+        case MODE_BLOCK:
+            alarm(EVENT_TIMEOUT_MS / 1000);
+            ret = read(fd, events, sizeof(events));
+            alarm(0);
+            return ret > 0 ? 0 : -1;
+
+        case MODE_POLL:
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if(poll(&pfd, 1, EVENT_TIMEOUT_MS) <= 0)
+                return -1;
+            return read(fd, events, sizeof(events)) > 0 ? 0 : -1;
+
+        case MODE_SIGIO:
+            sigemptyset(&set);
+            sigaddset(&set, SIGIO);
+            ts.tv_sec = EVENT_TIMEOUT_MS / 1000;
+            ts.tv_nsec = EVENT_TIMEOUT_MS % 1000 * 1000000L;
+            if(sigtimedwait(&set, NULL, &ts) < 0)
+                return -1;
+            return read(fd, events, sizeof(events)) > 0 ? 0 : -1;
+
+        case MODE_INPUT:
+            /*跳过EV_SYN和重复事件*/
+            alarm(EVENT_TIMEOUT_MS / 1000);
+            while((ret = read(fd, &ie, sizeof(ie))) == sizeof(ie)){
+                if(ie.type == EV_KEY && ie.value != 2)
+                    break;
+            }
+            alarm(0);
+            return ret == sizeof(ie) ? 0 : -1;
+
+        case MODE_RING:
+            /*缓冲区中有事件时不进入内核*/
+            if(ring_consume())
+                return 0;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if(poll(&pfd, 1, EVENT_TIMEOUT_MS) <= 0)
+                return -1;
+            return ring_consume() ? 0 : -1;
+    }
+    return -1;
+}
+
+static int set_line(int emu, int level)
+{
+    char buf[8];
+    int len = snprintf(buf, sizeof(buf), "%d %d", EMU_LINE, level);
+
+    return write(emu, buf, len) == len ? 0 : -1;
+}
+
+static void print_header(void)
+{
+    printf("%-12s %-6s %6s %5s %8s %8s %8s %8s %8s %9s %9s\r\n",
+           "name", "mode", "edges", "lost", "p50 us", "p90 us", "p99 us", "max us", "avg us",
+           "app cpu", "sys cpu");
+}
+
+int main(int argc, char *argv[])
+{
+    int fd, emu, i, n = 0;
+    int count = 1000;
+    int lost = 0;
+    int flags;
+    enum bench_mode mode;
+    const char *name;
+    long long t, sum = 0;
+    long long cpu_start, cpu_end, sys_start, sys_end;
+    long long *lat;
+    sigset_t set;
+    struct sigaction sa;
+
+    if(argc == 2 && !strcmp(argv[1], "-H"))
+    {
+        print_header();
+        return 0;
+    }
+    if(argc < 3 || argc > 5)
+    {
+        printf("Error param!\r\n");
+        return -1;
+    }
+    for(mode = MODE_READ; mode <= MODE_RING; mode++)
+    {
+        if(!strcmp(argv[1], mode_names[mode]))
+            break;
+    }
+    if(mode > MODE_RING)
+    {
+        printf("unknown mode %s!\r\n", argv[1]);
+        return -1;
+    }
+    if(argc >= 4)
+        count = atoi(argv[3]);
+    if(count <= 0)
+        count = 1000;
+    name = argc == 5 ? argv[4] : argv[2];
+
+    lat = malloc(count * sizeof(lat[0]));
+    if(!lat)
+        return -1;
+
+    emu = open(EMU_DEV, O_WRONLY);
+    if(emu < 0)
+    {
+        printf("file %s open failed!\r\n", EMU_DEV);
+        free(lat);
+        return -1;
+    }
+    fd = open(argv[2], O_RDWR);
+    if(fd < 0)
+    {
+        printf("file %s open failed!\r\n", argv[2]);
+        close(emu);
+        free(lat);
+        return -1;
+    }
+
+    if(mode == MODE_RING)
+    {
+        ring = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(ring == MAP_FAILED)
+        {
+            printf("mmap %s failed!\r\n", argv[2]);
+            close(fd);
+            close(emu);
+            free(lat);
+            return -1;
+        }
+    }
+
+    /*SIGALRM打断阻塞的read(), 不能自动重启系统调用*/
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = alarm_func;
+    sigaction(SIGALRM, &sa, NULL);
+
+    if(mode == MODE_SIGIO)
+    {
+        /*SIGIO保持屏蔽, 由sigtimedwait同步取出*/
+        sigemptyset(&set);
+        sigaddset(&set, SIGIO);
+        sigprocmask(SIG_BLOCK, &set, NULL);
+        fcntl(fd, F_SETOWN, getpid());
+        flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, flags | FASYNC);
+    }
+
+    /*
+     * 从松开状态开始, keyemu的引脚复位和每次测试结束时都是高电平,
+     * 按键驱动刚加载, 队列中没有事件, 不需要先清空(blockio不支持O_NONBLOCK)
+     */
+    set_line(emu, 1);
+    usleep(EDGE_GAP_US);
+
+    cpu_start = cpu_us();
+    sys_start = sys_busy_us();
+    for(i = 0; i < count; i++)
+    {
+        /*偶数次按下, 奇数次松开*/
+        t = now_ns();
+        if(set_line(emu, i & 1) < 0)
+        {
+            printf("write %s failed!\r\n", EMU_DEV);
+            break;
+        }
+        if(wait_event(fd, mode) < 0)
+        {
+            lost++;
+        }
+        else
+        {
+            lat[n] = now_ns() - t;
+            sum += lat[n];
+            n++;
+        }
+        usleep(EDGE_GAP_US);
+    }
+    cpu_end = cpu_us();
+    sys_end = sys_busy_us();
+
+    set_line(emu, 1);
+    if(mode == MODE_RING)
+        munmap(ring, getpagesize());
+    close(fd);
+    close(emu);
+
+    if(n == 0)
+    {
+        printf("%-12s %-6s no events!\r\n", name, mode_names[mode]);
+        free(lat);
+        return -1;
+    }
+
+    qsort(lat, n, sizeof(lat[0]), cmp_ll);
+    printf("%-12s %-6s %6d %5d %8lld %8lld %8lld %8lld %8lld %9lld %9lld\r\n",
+           name, mode_names[mode], i, lost,
+           lat[(n - 1) * 50 / 100] / 1000, lat[(n - 1) * 90 / 100] / 1000,
+           lat[(n - 1) * 99 / 100] / 1000, lat[n - 1] / 1000, sum / n / 1000,
+           (cpu_end - cpu_start) / i,
+           sys_start < 0 ? -1 : (sys_end - sys_start) / i);
+
+    free(lat);
+    return 0;
+}
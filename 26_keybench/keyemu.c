@@ -0,0 +1,247 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/bitops.h>
+#include <linux/irq.h>
+#include <linux/interrupt.h>
+#include <linux/of.h>
+#include <linux/gpio/driver.h>
+#include <linux/miscdevice.h>
+#include <linux/platform_device.h>
+#include <asm/uaccess.h>
+
+/*
+ * 软件GPIO控制器, 用来在没有按键硬件时驱动各个按键驱动并测量延迟:
+ * 注册一个带中断的gpio_chip, 设备树中的key节点改为使用它的引脚,
+ * 未修改的按键驱动(14~17, 21)即可正常加载。4.1内核还没有gpio-mockup和gpio-sim,
+ * 这里用一个很小的模型代替。
+ *
+ * 设备树:
+ *     keyemu: keyemu {
+ *         compatible = "alk,keyemu";
+ *         gpio-controller;
+ *         #gpio-cells = <2>;
+ *     };
+ *     key {
+ *         key-gpios = <&keyemu 0 GPIO_ACTIVE_LOW>;
+ *         ...
+ *     };
+ *
+ * 引脚复位后为高电平(按键松开), 向/dev/keyemu写入"引脚 电平"改变电平, 例如:
+ *     echo "0 0" > /dev/keyemu     按下
+ *     echo "0 1" > /dev/keyemu     松开
+ * 电平变化时在write()中关中断调用该引脚的中断处理函数, 和真实的边沿中断一样,
+ * 按键驱动的上半部在write()返回之前就已经执行完。
+ * 先加载keyemu.ko再加载按键驱动, 卸载时先卸载按键驱动
+ */
+
+#define EMU_NAME            "keyemu"
+#define EMU_MAX_GPIO        32
+
+/*引脚个数*/
+static unsigned int ngpio = 2;
+module_param(ngpio, uint, 0444);
+MODULE_PARM_DESC(ngpio, "number of emulated key lines, 1-32");
+
+/*模拟器状态*/
+struct keyemu_dev {
+    struct gpio_chip chip;      /* 软件GPIO控制器 */
+    struct miscdevice misc;     /* /dev/keyemu, 用来改变引脚电平 */
+    struct mutex lock;          /* 串行化电平修改 */
+    unsigned long level;        /* 每一位为一个引脚的电平 */
+    int irq_base;               /* 第一个引脚的中断号, 每个引脚一个 */
+    u64 edges;                  /* 产生的边沿个数 */
+};
+
+static struct keyemu_dev *keyemu;   /*只支持一个实例, misc设备通过它找到模拟器*/
+
+static int keyemu_get(struct gpio_chip *chip, unsigned offset)
+{
+    struct keyemu_dev *emu = container_of(chip, struct keyemu_dev, chip);
+
+    return test_bit(offset, &emu->level);
+}
+
+/*引脚只能作为输入, 电平由/dev/keyemu控制*/
+static int keyemu_direction_input(struct gpio_chip *chip, unsigned offset)
+{
+    return 0;
+}
+
+static int keyemu_to_irq(struct gpio_chip *chip, unsigned offset)
+{
+    struct keyemu_dev *emu = container_of(chip, struct keyemu_dev, chip);
+
+    return emu->irq_base + offset;
+}
+
+/*
+* @description : 设置一个引脚的电平, 电平变化时产生边沿中断
+*/
+static void keyemu_set_level(struct keyemu_dev *emu, unsigned int line, int level)
+{
+    unsigned long flags;
+
+    mutex_lock(&emu->lock);
+    if(!!test_bit(line, &emu->level) != !!level){
+        if(level)
+            set_bit(line, &emu->level);
+        else
+            clear_bit(line, &emu->level);
+        emu->edges++;
+
+        /*中断处理函数要求在关中断的状态下运行*/
+        local_irq_save(flags);
+        generic_handle_irq(emu->irq_base + line);
+        local_irq_restore(flags);
+    }
+    mutex_unlock(&emu->lock);
+}
+
+/*
+* @description : 写入"引脚 电平", 例如"0 0"
+*/
+static ssize_t keyemu_write(struct file *filp, const char __user *buf, size_t cnt, loff_t *offt)
+{
+    char kbuf[16];
+    unsigned int line, level;
+    struct keyemu_dev *emu = keyemu;
+
+    if(cnt >= sizeof(kbuf))
+        return -EINVAL;
+    if(copy_from_user(kbuf, buf, cnt))
+        return -EFAULT;
+    kbuf[cnt] = '\0';
+
+    if(sscanf(kbuf, "%u %u", &line, &level) != 2 || line >= emu->chip.ngpio)
+        return -EINVAL;
+    keyemu_set_level(emu, line, level);
+    return cnt;
+}
+
+static const struct file_operations keyemu_fops = {
+    .owner = THIS_MODULE,
+    .write = keyemu_write,
+};
+
+/*
+* @description : 每个引脚分配一个软件中断号
+*/
+static int keyemu_irq_alloc(struct keyemu_dev *emu)
+{
+    int i;
+    int base = irq_alloc_descs(-1, 0, emu->chip.ngpio, numa_node_id());
+
+    if(base < 0)
+        return base;
+    for(i = 0; i < emu->chip.ngpio; i++){
+        irq_set_chip_and_handler(base + i, &dummy_irq_chip, handle_simple_irq);
+        irq_modify_status(base + i, IRQ_NOREQUEST | IRQ_NOPROBE, 0);
+    }
+    emu->irq_base = base;
+    return 0;
+}
+
+static int keyemu_probe(struct platform_device *pdev)
+{
+    int ret;
+    struct keyemu_dev *emu;
+
+    if(keyemu)
+        return -EBUSY;
+    if(ngpio < 1 || ngpio > EMU_MAX_GPIO)
+        return -EINVAL;
+
+    emu = devm_kzalloc(&pdev->dev, sizeof(*emu), GFP_KERNEL);
+    if(!emu)
+        return -ENOMEM;
+
+    mutex_init(&emu->lock);
+    emu->level = ~0UL;                      /* 按键松开 */
+    platform_set_drvdata(pdev, emu);
+
+    emu->chip.label = EMU_NAME;
+    emu->chip.dev = &pdev->dev;
+    emu->chip.owner = THIS_MODULE;
+    emu->chip.base = -1;                    /* 动态分配GPIO编号 */
+    emu->chip.ngpio = ngpio;
+    emu->chip.get = keyemu_get;
+    emu->chip.direction_input = keyemu_direction_input;
+    emu->chip.to_irq = keyemu_to_irq;
+    emu->chip.of_node = pdev->dev.of_node;  /* 设备树通过&keyemu引用这些引脚 */
+
+    ret = keyemu_irq_alloc(emu);
+    if(ret < 0)
+        return ret;
+
+    ret = gpiochip_add(&emu->chip);
+    if(ret < 0)
+        goto fail_gpiochip;
+
+    emu->misc.minor = MISC_DYNAMIC_MINOR;
+    emu->misc.name = EMU_NAME;
+    emu->misc.fops = &keyemu_fops;
+    keyemu = emu;
+    ret = misc_register(&emu->misc);
+    if(ret < 0)
+        goto fail_misc;
+
+    printk("%s: gpio %d~%d, irq %d~%d\r\n", EMU_NAME, emu->chip.base,
+           emu->chip.base + ngpio - 1, emu->irq_base, emu->irq_base + ngpio - 1);
+    return 0;
+
+fail_misc:
+    keyemu = NULL;
+    gpiochip_remove(&emu->chip);
+fail_gpiochip:
+    irq_free_descs(emu->irq_base, ngpio);
+    return ret;
+}
+
+static int keyemu_remove(struct platform_device *pdev)
+{
+    struct keyemu_dev *emu = platform_get_drvdata(pdev);
+
+    printk("%s: %llu edges\r\n", EMU_NAME, emu->edges);
+
+    misc_deregister(&emu->misc);
+    keyemu = NULL;
+    gpiochip_remove(&emu->chip);
+    irq_free_descs(emu->irq_base, emu->chip.ngpio);
+    return 0;
+}
+
+static const struct of_device_id keyemu_of_match[] = {
+    { .compatible = "alk,keyemu" },
+    { /* sentinel */ }
+};
+MODULE_DEVICE_TABLE(of, keyemu_of_match);
+
+static struct platform_driver keyemu_driver = {
+    .probe = keyemu_probe,
+    .remove = keyemu_remove,
+    .driver = {
+        .name = EMU_NAME,
+        .owner = THIS_MODULE,
+        .of_match_table = keyemu_of_match,
+    },
+};
+
+static int __init keyemu_init(void)
+{
+    return platform_driver_register(&keyemu_driver);
+}
+
+static void __exit keyemu_exit(void)
+{
+    platform_driver_unregister(&keyemu_driver);
+}
+
+module_init(keyemu_init);
+module_exit(keyemu_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("mankc");
@@ -0,0 +1,28 @@
+#ifndef _KEYEVENT_H
+#define _KEYEVENT_H
+
+/*
+ * 按键驱动与应用程序共用的事件格式
+ * read()的缓冲区不小于struct key_event时, 一次返回缓冲区能容纳的所有事件和它们的长度,
+ * 否则按旧格式返回1个字节的键值, 只报告按键释放, read返回0
+ */
+#include <linux/types.h>
+
+struct key_event {
+    __s64 timestamp;    /* 按键开始抖动(第一个边沿)的ktime(CLOCK_MONOTONIC, 单位ns) */
+    __u16 code;         /* 键值 */
+    __u16 value;        /* 1 按下, 0 释放 */
+    __u32 reserved;
+};
+
+/* mmap()映射的事件环形缓冲区, 说明见16_noblockio/keyevent.h */
+struct key_ring {
+    __u32 head;         /* 内核已写入的事件个数, 只由内核修改 */
+    __u32 tail;         /* 应用已读取的事件个数, 只由应用修改 */
+    __u32 size;         /* events的个数, 2的幂 */
+    __u32 dropped;      /* 缓冲区满时丢弃的事件个数 */
+    __u32 reserved[4];
+    struct key_event events[];
+};
+
+#endif // !_KEYEVENT_H